@@ -0,0 +1,156 @@
+// Event loop benchmark: runs webserv with syscall_count preloaded, sends
+// keep-alive requests over one connection and reports the I/O and epoll
+// calls per request for level and edge triggered mode. Two runs of
+// different length are subtracted, so startup and shutdown cancel out.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+
+static const uint16_t g_port = 18080;
+
+using Counts = std::map<std::string, double>;
+
+static int connectServer( void ) {
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(g_port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	for (int attempt = 0; attempt < 200; ++attempt) {
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+			return fd;
+		}
+		close(fd);
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	return -1;
+}
+
+// Reads one response with a Content-Length body, returns false on EOF
+static bool readResponse( int fd, std::string& buffer ) {
+	char chunk[65536];
+	size_t header_end;
+	while ((header_end = buffer.find("\r\n\r\n")) == std::string::npos) {
+		ssize_t bytes = recv(fd, chunk, sizeof(chunk), 0);
+		if (bytes <= 0) return false;
+		buffer.append(chunk, bytes);
+	}
+	size_t length_pos = buffer.find("Content-Length: ");
+	size_t body_size = length_pos < header_end ? std::stoul(buffer.substr(length_pos + 16)) : 0;
+	size_t total = header_end + 4 + body_size;
+	while (buffer.size() < total) {
+		ssize_t bytes = recv(fd, chunk, sizeof(chunk), 0);
+		if (bytes <= 0) return false;
+		buffer.append(chunk, bytes);
+	}
+	buffer.erase(0, total);
+	return true;
+}
+
+static Counts runServer( const std::string& webserv, const std::string& shim, const std::string& config,
+						 const std::string& out, const std::string& path, size_t requests, double& seconds ) {
+	pid_t pid = fork();
+	if (pid == 0) {
+		setenv("LD_PRELOAD", shim.c_str(), 1);
+		setenv("SYSCALL_COUNT_OUT", out.c_str(), 1);
+		freopen("/dev/null", "w", stdout);
+		freopen("/dev/null", "w", stderr);
+		execl(webserv.c_str(), webserv.c_str(), config.c_str(), static_cast<char*>(nullptr));
+		_exit(127);
+	}
+	Counts counts;
+	int fd = connectServer();
+	if (fd == -1) {
+		std::cerr << "webserv did not start" << std::endl;
+		kill(pid, SIGKILL);
+		waitpid(pid, nullptr, 0);
+		return counts;
+	}
+	std::string request = "GET " + path + " HTTP/1.1\r\nHost: bench\r\n\r\n";
+	std::string buffer;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < requests; ++i) {
+		if (send(fd, request.data(), request.size(), 0) <= 0 || !readResponse(fd, buffer)) {
+			std::cerr << "request " << i << " failed" << std::endl;
+			break;
+		}
+	}
+	seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	close(fd);
+	// the connection counts as closed before the server stops
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	kill(pid, SIGINT);
+	waitpid(pid, nullptr, 0);
+	std::ifstream file(out);
+	std::string name;
+	double count;
+	while (file >> name >> count) {
+		counts[name] = count;
+	}
+	return counts;
+}
+
+static void writeConfig( const std::string& path, const std::string& mode, const std::string& root ) {
+	std::ofstream config(path);
+	config << "logging_level: ERROR\n"
+		   << "worker_threads: 1\n"
+		   << "event_mode: " << mode << "\n"
+		   << "keepalive_requests: 1000000\n"
+		   << "\nserver:\n"
+		   << "\tlisten: 127.0.0.1:" << g_port << "\n"
+		   << "\tlocation /:\n"
+		   << "\t\troot: " << root << "\n"
+		   << "\t\topen_cache_size: 8388608\n";
+}
+
+int main( int argc, char** argv ) {
+	std::string webserv = argc > 1 ? argv[1] : "./webserv";
+	std::string shim = argc > 2 ? argv[2] : "./obj/syscall_count.so";
+	char dir_template[] = "/tmp/event_bench.XXXXXX";
+	std::string dir = mkdtemp(dir_template);
+	std::ofstream(dir + "/small.html") << std::string(1024, 's');
+	std::ofstream(dir + "/large.bin") << std::string(1 << 20, 'l');
+	const size_t short_run = 100;
+	const size_t long_run = 1100;
+	const char* shown[] = {"recv", "sendmsg", "sendfile", "epoll_wait", "epoll_ctl"};
+
+	std::cout << std::left << std::setw(7) << "mode" << std::setw(12) << "file";
+	for (const char* name : shown) std::cout << std::right << std::setw(12) << name;
+	std::cout << std::setw(12) << "total" << std::setw(12) << "req/s" << std::endl;
+	for (const std::string mode : {"level", "edge"}) {
+		std::string config = dir + "/" + mode + ".conf";
+		writeConfig(config, mode, dir);
+		for (const std::string file : {"/small.html", "/large.bin"}) {
+			double seconds;
+			Counts base = runServer(webserv, shim, config, dir + "/counts", file, short_run, seconds);
+			Counts counts = runServer(webserv, shim, config, dir + "/counts", file, long_run, seconds);
+			std::cout << std::left << std::setw(7) << mode << std::setw(12) << file.substr(1) << std::right
+					  << std::fixed << std::setprecision(2);
+			double total = 0;
+			for (const auto& [name, count] : counts) {
+				total += (count - base[name]) / (long_run - short_run);
+			}
+			for (const char* name : shown) {
+				std::cout << std::setw(12) << (counts[name] - base[name]) / (long_run - short_run);
+			}
+			std::cout << std::setw(12) << total << std::setw(12) << std::setprecision(0)
+					  << long_run / seconds << std::endl;
+		}
+	}
+	std::system(("rm -rf " + dir).c_str());
+	return 0;
+}
@@ -0,0 +1,687 @@
+// Load generator: replays weighted request mixes from JSONL scenario files
+// over many non-blocking connections driven by epoll, one event loop per
+// thread, and reports requests per second and latency percentiles. With -s
+// it first starts webserv with the given config and stops it at the end.
+//
+// Every line of a scenario file is one request of the mix:
+//   {"method": "GET", "path": "/index.html", "weight": 4,
+//    "headers": {"Accept-Encoding": "gzip"}, "body": "..."}
+// Only "path" is required; the method defaults to GET and the weight to 1.
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Histogram.hpp"
+
+struct Options {
+	std::string					address = "127.0.0.1";
+	uint16_t					port = 18081;
+	size_t						connections = 64;
+	size_t						threads = 2;
+	double						duration = 5; // seconds measured
+	double						warmup = 1; // seconds run before measuring
+	size_t						pipeline = 1; // requests in flight per connection
+	bool						keepalive = true;
+	std::string					server; // webserv to start, empty to use a running one
+	std::string					config;
+	std::vector<std::string>	scenarios;
+};
+
+struct Scenario {
+	std::string					name;
+	std::vector<std::string>	requests; // ready to send
+	std::vector<bool>			head; // the response to it has no body
+	std::vector<uint64_t>		cumulative_weight;
+};
+
+// ---------------------------------------------------------------- scenarios
+
+// Just enough JSON for flat objects of strings and numbers, plus one level
+// of nesting for "headers"
+class JsonReader {
+private:
+	const std::string&	_text;
+	size_t				_pos;
+
+	void _skipSpace( void ) {
+		while (_pos < _text.size() && std::isspace(static_cast<unsigned char>(_text[_pos]))) ++_pos;
+	}
+
+public:
+	JsonReader( const std::string& text ) : _text(text), _pos(0) {}
+
+	bool expect( char c ) {
+		_skipSpace();
+		if (_pos < _text.size() && _text[_pos] == c) {
+			++_pos;
+			return true;
+		}
+		return false;
+	}
+
+	bool peek( char c ) {
+		_skipSpace();
+		return _pos < _text.size() && _text[_pos] == c;
+	}
+
+	bool atEnd( void ) {
+		_skipSpace();
+		return _pos == _text.size();
+	}
+
+	bool readString( std::string& out ) {
+		out.clear();
+		if (!expect('"')) return false;
+		while (_pos < _text.size() && _text[_pos] != '"') {
+			char c = _text[_pos++];
+			if (c == '\\' && _pos < _text.size()) {
+				c = _text[_pos++];
+				switch (c) {
+					case 'n': c = '\n'; break;
+					case 'r': c = '\r'; break;
+					case 't': c = '\t'; break;
+					case 'u': {
+						// only the code points below 0x80 a request line can hold
+						if (_pos + 4 > _text.size()) return false;
+						c = static_cast<char>(std::strtol(_text.substr(_pos, 4).c_str(), nullptr, 16));
+						_pos += 4;
+						break;
+					}
+					default: break; // \" \\ \/
+				}
+			}
+			out += c;
+		}
+		return expect('"');
+	}
+
+	bool readNumber( uint64_t& out ) {
+		_skipSpace();
+		size_t start = _pos;
+		while (_pos < _text.size() && std::isdigit(static_cast<unsigned char>(_text[_pos]))) ++_pos;
+		if (start == _pos) return false;
+		out = std::stoull(_text.substr(start, _pos - start));
+		return true;
+	}
+};
+
+static bool parseHeaders( JsonReader& reader, std::string& headers ) {
+	std::string name;
+	std::string value;
+	if (!reader.expect('{')) return false;
+	if (reader.expect('}')) return true;
+	do {
+		if (!reader.readString(name) || !reader.expect(':') || !reader.readString(value)) return false;
+		headers += name + ": " + value + "\r\n";
+	} while (reader.expect(','));
+	return reader.expect('}');
+}
+
+// Builds the request of one line, returns its weight or 0 on a bad line
+static uint64_t parseRequestLine( const std::string& line, const Options& options, std::string& request, bool& head ) {
+	JsonReader reader(line);
+	std::string method = "GET";
+	std::string path;
+	std::string headers;
+	std::string body;
+	uint64_t weight = 1;
+	std::string key;
+	if (!reader.expect('{')) return 0;
+	if (!reader.peek('}')) {
+		do {
+			if (!reader.readString(key) || !reader.expect(':')) return 0;
+			bool ok;
+			if (key == "method") ok = reader.readString(method);
+			else if (key == "path") ok = reader.readString(path);
+			else if (key == "body") ok = reader.readString(body);
+			else if (key == "weight") ok = reader.readNumber(weight);
+			else if (key == "headers") ok = parseHeaders(reader, headers);
+			else ok = false;
+			if (!ok) return 0;
+		} while (reader.expect(','));
+	}
+	if (!reader.expect('}') || !reader.atEnd() || path.empty()) return 0;
+	request = method + " " + path + " HTTP/1.1\r\nHost: bench\r\n" + headers;
+	if (!body.empty()) {
+		request += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+	}
+	if (!options.keepalive) {
+		request += "Connection: close\r\n";
+	}
+	request += "\r\n" + body;
+	head = method == "HEAD";
+	return weight;
+}
+
+static bool loadScenario( const std::string& path, const Options& options, Scenario& scenario ) {
+	std::ifstream file(path);
+	if (!file) {
+		std::cerr << path << ": cannot open" << std::endl;
+		return false;
+	}
+	size_t slash = path.rfind('/');
+	scenario.name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+	scenario.name = scenario.name.substr(0, scenario.name.rfind(".jsonl"));
+	std::string line;
+	uint64_t total = 0;
+	for (size_t number = 1; std::getline(file, line); ++number) {
+		if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+		std::string request;
+		bool head;
+		uint64_t weight = parseRequestLine(line, options, request, head);
+		if (weight == 0) {
+			std::cerr << path << ":" << number << ": bad request line" << std::endl;
+			return false;
+		}
+		total += weight;
+		scenario.requests.push_back(request);
+		scenario.head.push_back(head);
+		scenario.cumulative_weight.push_back(total);
+	}
+	if (scenario.requests.empty()) {
+		std::cerr << path << ": no requests" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// ---------------------------------------------------------------- responses
+
+enum ParseState {
+	PARSE_HEADER,
+	PARSE_BODY, // Content-Length bytes left
+	PARSE_CHUNK_SIZE,
+	PARSE_CHUNK_DATA, // chunk bytes and their CRLF left
+	PARSE_TRAILER,
+	PARSE_UNTIL_CLOSE
+};
+
+struct Connection {
+	int						fd = -1;
+	bool					connected = false;
+	bool					writing = false; // EPOLLOUT is on
+	std::string				out;
+	size_t					out_offset = 0;
+	std::string				line; // header block or chunk line received so far
+	ParseState				state = PARSE_HEADER;
+	uint64_t				remaining = 0;
+	int						status = 0;
+	bool					close = false; // the server closes after this response
+	size_t					sent_requests = 0; // on this connection
+	std::deque<std::pair<int64_t, bool>>	in_flight; // start time and whether it is HEAD
+};
+
+struct WorkerStats {
+	Histogram				latency; // us
+	uint64_t				completed = 0;
+	uint64_t				errors = 0;
+	uint64_t				bytes = 0;
+	std::array<uint64_t, 6>	status_class = {}; // 1xx..5xx, 0 for anything else
+};
+
+static int64_t nowUsec( void ) {
+	timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return static_cast<int64_t>(time.tv_sec) * 1000000 + time.tv_nsec / 1000;
+}
+
+class Worker {
+private:
+	const Options&			_options;
+	const Scenario&			_scenario;
+	const sockaddr_in&		_address;
+	int						_epoll_fd;
+	std::vector<Connection>	_connections;
+	uint64_t				_random;
+	int64_t					_measure_from;
+	int64_t					_measure_until;
+
+	size_t _pick( void ) {
+		_random ^= _random << 13;
+		_random ^= _random >> 7;
+		_random ^= _random << 17;
+		uint64_t target = _random % _scenario.cumulative_weight.back();
+		return std::upper_bound(_scenario.cumulative_weight.begin(), _scenario.cumulative_weight.end(), target)
+			- _scenario.cumulative_weight.begin();
+	}
+
+	void _open( Connection& connection, size_t index ) {
+		connection = Connection();
+		connection.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (connection.fd == -1) {
+			++stats.errors;
+			return;
+		}
+		int one = 1;
+		setsockopt(connection.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		int result = connect(connection.fd, reinterpret_cast<const sockaddr*>(&_address), sizeof(_address));
+		if (result == -1 && errno != EINPROGRESS) {
+			++stats.errors;
+			::close(connection.fd);
+			connection.fd = -1;
+			return;
+		}
+		// without keep-alive the handshake counts into the latency
+		_fill(connection);
+		epoll_event event = {};
+		event.events = EPOLLIN | EPOLLOUT;
+		event.data.u64 = index;
+		epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, connection.fd, &event);
+		connection.writing = true;
+	}
+
+	void _reopen( Connection& connection, size_t index, bool failed ) {
+		if (failed) {
+			++stats.errors;
+		}
+		::close(connection.fd);
+		connection.fd = -1;
+		_open(connection, index);
+	}
+
+	// Keeps the pipeline full, a connection that will be closed gets one request
+	void _fill( Connection& connection ) {
+		size_t depth = _options.keepalive ? _options.pipeline : 1;
+		if (!_options.keepalive && connection.sent_requests > 0) return;
+		int64_t now = nowUsec();
+		while (connection.in_flight.size() < depth) {
+			size_t pick = _pick();
+			connection.out += _scenario.requests[pick];
+			connection.in_flight.emplace_back(now, _scenario.head[pick]);
+			++connection.sent_requests;
+		}
+	}
+
+	void _setWriting( Connection& connection, size_t index, bool writing ) {
+		if (connection.writing == writing) return;
+		epoll_event event = {};
+		event.events = writing ? EPOLLIN | EPOLLOUT : EPOLLIN;
+		event.data.u64 = index;
+		epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, connection.fd, &event);
+		connection.writing = writing;
+	}
+
+	// Returns false when the connection failed
+	bool _flush( Connection& connection, size_t index ) {
+		while (connection.out_offset < connection.out.size()) {
+			ssize_t bytes = send(connection.fd, connection.out.data() + connection.out_offset,
+				connection.out.size() - connection.out_offset, MSG_NOSIGNAL);
+			if (bytes == -1) {
+				if (errno == EAGAIN) {
+					_setWriting(connection, index, true);
+					return true;
+				}
+				return false;
+			}
+			connection.out_offset += bytes;
+		}
+		connection.out.clear();
+		connection.out_offset = 0;
+		_setWriting(connection, index, false);
+		return true;
+	}
+
+	void _complete( Connection& connection ) {
+		int64_t now = nowUsec();
+		int64_t started = connection.in_flight.front().first;
+		connection.in_flight.pop_front();
+		if (started >= _measure_from && now <= _measure_until) {
+			stats.latency.record(now - started);
+			++stats.completed;
+			++stats.status_class[connection.status >= 100 && connection.status < 600 ? connection.status / 100 : 0];
+		}
+		connection.state = PARSE_HEADER;
+	}
+
+	// The status line, Content-Length, Transfer-Encoding and Connection
+	void _parseHeader( Connection& connection ) {
+		const std::string& header = connection.line;
+		connection.status = header.size() > 12 ? std::atoi(header.c_str() + 9) : 0;
+		bool chunked = false;
+		bool has_length = false;
+		connection.remaining = 0;
+		size_t pos = header.find("\r\n");
+		while (pos != std::string::npos && pos + 2 < header.size()) {
+			size_t end = header.find("\r\n", pos + 2);
+			std::string field = header.substr(pos + 2, end - pos - 2);
+			std::transform(field.begin(), field.end(), field.begin(), ::tolower);
+			if (field.rfind("content-length:", 0) == 0) {
+				connection.remaining = std::strtoull(field.c_str() + 15, nullptr, 10);
+				has_length = true;
+			} else if (field.rfind("transfer-encoding:", 0) == 0) {
+				chunked = field.find("chunked") != std::string::npos;
+			} else if (field.rfind("connection:", 0) == 0) {
+				connection.close = field.find("close") != std::string::npos;
+			}
+			pos = end;
+		}
+		bool bodyless = connection.in_flight.front().second || connection.status / 100 == 1
+			|| connection.status == 204 || connection.status == 304;
+		if (bodyless || (has_length && connection.remaining == 0 && !chunked)) {
+			_complete(connection);
+		} else if (chunked) {
+			connection.state = PARSE_CHUNK_SIZE;
+		} else if (has_length) {
+			connection.state = PARSE_BODY;
+		} else {
+			connection.state = PARSE_UNTIL_CLOSE;
+		}
+	}
+
+	// Appends to the pending line until the terminator, returns the bytes
+	// taken or 0 with everything taken and the line still incomplete
+	static size_t _takeLine( std::string& line, const char* data, size_t size, const char* terminator ) {
+		size_t old_size = line.size();
+		size_t length = std::strlen(terminator);
+		line.append(data, size);
+		size_t end = line.find(terminator, old_size >= length ? old_size - length + 1 : 0);
+		if (end == std::string::npos) return 0;
+		line.resize(end + length);
+		return end + length - old_size;
+	}
+
+	// Returns false on a malformed response
+	bool _consume( Connection& connection, const char* data, size_t size ) {
+		while (size > 0) {
+			if (connection.in_flight.empty()) return false; // a response nobody asked for
+			size_t taken = size;
+			switch (connection.state) {
+				case PARSE_HEADER:
+				case PARSE_CHUNK_SIZE:
+				case PARSE_TRAILER: {
+					const char* terminator = connection.state == PARSE_HEADER ? "\r\n\r\n" : "\r\n";
+					taken = _takeLine(connection.line, data, size, terminator);
+					if (taken == 0) {
+						if (connection.line.size() > 65536) return false;
+						return true;
+					}
+					if (connection.state == PARSE_HEADER) {
+						_parseHeader(connection);
+					} else if (connection.state == PARSE_TRAILER) {
+						if (connection.line == "\r\n") _complete(connection);
+					} else {
+						char* end;
+						connection.remaining = std::strtoull(connection.line.c_str(), &end, 16);
+						if (end == connection.line.c_str()) return false;
+						connection.state = connection.remaining == 0 ? PARSE_TRAILER : PARSE_CHUNK_DATA;
+						connection.remaining += 2;
+					}
+					connection.line.clear();
+					break;
+				}
+				case PARSE_BODY:
+				case PARSE_CHUNK_DATA:
+					taken = std::min<uint64_t>(size, connection.remaining);
+					connection.remaining -= taken;
+					if (connection.remaining == 0) {
+						if (connection.state == PARSE_BODY) _complete(connection);
+						else connection.state = PARSE_CHUNK_SIZE;
+					}
+					break;
+				case PARSE_UNTIL_CLOSE:
+					break;
+			}
+			data += taken;
+			size -= taken;
+		}
+		return true;
+	}
+
+	void _handle( size_t index, uint32_t events ) {
+		static thread_local char buffer[65536];
+		Connection& connection = _connections[index];
+		if (events & EPOLLOUT) {
+			if (!connection.connected) {
+				int error = 0;
+				socklen_t length = sizeof(error);
+				getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+				if (error != 0) return _reopen(connection, index, true);
+				connection.connected = true;
+			}
+			if (!_flush(connection, index)) return _reopen(connection, index, true);
+		}
+		if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR))) return;
+		ssize_t bytes = recv(connection.fd, buffer, sizeof(buffer), 0);
+		if (bytes == -1 && errno == EAGAIN) return;
+		if (bytes <= 0) {
+			// a close-delimited body ends here, any other response was cut short
+			bool delimited = bytes == 0 && connection.state == PARSE_UNTIL_CLOSE;
+			if (delimited) _complete(connection);
+			return _reopen(connection, index, !delimited || !connection.in_flight.empty());
+		}
+		if (_measure_from <= nowUsec()) stats.bytes += bytes;
+		if (!_consume(connection, buffer, bytes)) return _reopen(connection, index, true);
+		// requests pipelined behind a closing response are not answered
+		if ((connection.close && connection.state == PARSE_HEADER)
+			|| (!_options.keepalive && connection.in_flight.empty())) {
+			return _reopen(connection, index, false);
+		}
+		if (connection.close) return; // no new requests, wait for the end of the body
+		_fill(connection);
+		if (!connection.out.empty() && !_flush(connection, index)) _reopen(connection, index, true);
+	}
+
+public:
+	WorkerStats	stats;
+
+	Worker( const Options& options, const Scenario& scenario, const sockaddr_in& address, size_t connections, uint64_t seed )
+		: _options(options), _scenario(scenario), _address(address), _epoll_fd(-1),
+		  _connections(connections), _random(seed | 1), _measure_from(0), _measure_until(0) {}
+
+	void run( int64_t measure_from, int64_t measure_until ) {
+		_measure_from = measure_from;
+		_measure_until = measure_until;
+		_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		for (size_t i = 0; i < _connections.size(); ++i) {
+			_open(_connections[i], i);
+		}
+		epoll_event events[256];
+		while (nowUsec() < measure_until) {
+			int count = epoll_wait(_epoll_fd, events, 256, 10);
+			for (int i = 0; i < count; ++i) {
+				_handle(events[i].data.u64, events[i].events);
+			}
+			// connections that failed to open are retried here
+			for (size_t i = 0; i < _connections.size(); ++i) {
+				if (_connections[i].fd == -1) _open(_connections[i], i);
+			}
+		}
+		for (Connection& connection : _connections) {
+			if (connection.fd != -1) ::close(connection.fd);
+		}
+		close(_epoll_fd);
+	}
+};
+
+// ---------------------------------------------------------------- driver
+
+static std::string formatUsec( uint64_t usec ) {
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(2);
+	if (usec < 1000) out << usec << "us";
+	else if (usec < 1000000) out << usec / 1e3 << "ms";
+	else out << usec / 1e6 << "s";
+	return out.str();
+}
+
+static void runScenario( const Options& options, const Scenario& scenario, const sockaddr_in& address ) {
+	std::vector<std::unique_ptr<Worker>> workers;
+	size_t threads = std::max<size_t>(1, std::min(options.threads, options.connections));
+	for (size_t i = 0; i < threads; ++i) {
+		size_t connections = options.connections / threads + (i < options.connections % threads ? 1 : 0);
+		workers.push_back(std::make_unique<Worker>(options, scenario, address, connections, 0x9e3779b97f4a7c15ULL * (i + 1)));
+	}
+	int64_t measure_from = nowUsec() + static_cast<int64_t>(options.warmup * 1e6);
+	int64_t measure_until = measure_from + static_cast<int64_t>(options.duration * 1e6);
+	std::vector<std::thread> running;
+	for (auto& worker : workers) {
+		running.emplace_back(&Worker::run, worker.get(), measure_from, measure_until);
+	}
+	for (std::thread& thread : running) {
+		thread.join();
+	}
+
+	Histogram latency;
+	WorkerStats total;
+	for (auto& worker : workers) {
+		latency.merge(worker->stats.latency);
+		total.completed += worker->stats.completed;
+		total.errors += worker->stats.errors;
+		total.bytes += worker->stats.bytes;
+		for (size_t i = 0; i < total.status_class.size(); ++i) {
+			total.status_class[i] += worker->stats.status_class[i];
+		}
+	}
+	std::string mode = options.keepalive ? "keepalive" : "close";
+	if (options.keepalive && options.pipeline > 1) mode += "/p" + std::to_string(options.pipeline);
+	std::cout << std::left << std::setw(16) << scenario.name << std::setw(14) << mode << std::right
+			  << std::setw(6) << options.connections << std::setw(10) << total.completed
+			  << std::fixed << std::setprecision(0) << std::setw(10) << total.completed / options.duration
+			  << std::setprecision(1) << std::setw(9) << total.bytes / options.duration / (1 << 20)
+			  << std::setw(10) << formatUsec(latency.percentile(50))
+			  << std::setw(10) << formatUsec(latency.percentile(99))
+			  << std::setw(10) << formatUsec(latency.percentile(99.9))
+			  << std::setw(10) << formatUsec(latency.max());
+	for (size_t i = 2; i < total.status_class.size(); ++i) {
+		std::cout << std::setw(8) << total.status_class[i];
+	}
+	std::cout << std::setw(8) << total.errors + total.status_class[0] + total.status_class[1] << std::endl;
+}
+
+static bool waitForServer( const sockaddr_in& address ) {
+	for (int attempt = 0; attempt < 500; ++attempt) {
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		bool ok = connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+		close(fd);
+		if (ok) return true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	return false;
+}
+
+static pid_t startServer( const Options& options ) {
+	pid_t pid = fork();
+	if (pid == 0) {
+		freopen("/dev/null", "w", stdout);
+		freopen("/dev/null", "w", stderr);
+		execl(options.server.c_str(), options.server.c_str(), options.config.c_str(), static_cast<char*>(nullptr));
+		_exit(127);
+	}
+	return pid;
+}
+
+static void usage( const char* name ) {
+	std::cerr << "usage: " << name << " [options] scenario.jsonl...\n"
+			  << "  -a addr:port   server to load (127.0.0.1:18081)\n"
+			  << "  -c count       connections (64)\n"
+			  << "  -t count       client threads (2)\n"
+			  << "  -d seconds     measured duration per scenario (5)\n"
+			  << "  -w seconds     warm-up before measuring (1)\n"
+			  << "  -p depth       pipelined requests per keep-alive connection (1)\n"
+			  << "  -C             one request per connection, Connection: close\n"
+			  << "  -s webserv     start this server for the run, with the config of -f\n"
+			  << "  -f config      server config for -s\n";
+}
+
+static bool parseOptions( int argc, char** argv, Options& options ) {
+	int option;
+	while ((option = getopt(argc, argv, "a:c:t:d:w:p:Cs:f:")) != -1) {
+		switch (option) {
+			case 'a': {
+				std::string value = optarg;
+				size_t colon = value.rfind(':');
+				if (colon == std::string::npos) return false;
+				options.address = value.substr(0, colon);
+				options.port = static_cast<uint16_t>(std::atoi(value.c_str() + colon + 1));
+				break;
+			}
+			case 'c': options.connections = std::strtoul(optarg, nullptr, 10); break;
+			case 't': options.threads = std::strtoul(optarg, nullptr, 10); break;
+			case 'd': options.duration = std::atof(optarg); break;
+			case 'w': options.warmup = std::atof(optarg); break;
+			case 'p': options.pipeline = std::strtoul(optarg, nullptr, 10); break;
+			case 'C': options.keepalive = false; break;
+			case 's': options.server = optarg; break;
+			case 'f': options.config = optarg; break;
+			default: return false;
+		}
+	}
+	for (int i = optind; i < argc; ++i) {
+		options.scenarios.push_back(argv[i]);
+	}
+	return !options.scenarios.empty() && options.connections > 0 && options.pipeline > 0
+		&& options.duration > 0 && (options.server.empty() || !options.config.empty());
+}
+
+int main( int argc, char** argv ) {
+	Options options;
+	if (!parseOptions(argc, argv, options)) {
+		usage(argv[0]);
+		return 1;
+	}
+	std::vector<Scenario> scenarios(options.scenarios.size());
+	for (size_t i = 0; i < scenarios.size(); ++i) {
+		if (!loadScenario(options.scenarios[i], options, scenarios[i])) return 1;
+	}
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(options.port);
+	if (inet_pton(AF_INET, options.address.c_str(), &address.sin_addr) != 1) {
+		std::cerr << options.address << ": not an IPv4 address" << std::endl;
+		return 1;
+	}
+	pid_t server = -1;
+	if (!options.server.empty()) {
+		server = startServer(options);
+	}
+	if (!waitForServer(address)) {
+		std::cerr << "no server on " << options.address << ":" << options.port << std::endl;
+		if (server > 0) {
+			kill(server, SIGKILL);
+			waitpid(server, nullptr, 0);
+		}
+		return 1;
+	}
+
+	std::cout << std::left << std::setw(16) << "scenario" << std::setw(14) << "mode" << std::right
+			  << std::setw(6) << "conns" << std::setw(10) << "requests" << std::setw(10) << "req/s"
+			  << std::setw(9) << "MiB/s" << std::setw(10) << "p50" << std::setw(10) << "p99"
+			  << std::setw(10) << "p99.9" << std::setw(10) << "max" << std::setw(8) << "2xx"
+			  << std::setw(8) << "3xx" << std::setw(8) << "4xx" << std::setw(8) << "5xx"
+			  << std::setw(8) << "errors" << std::endl;
+	for (const Scenario& scenario : scenarios) {
+		runScenario(options, scenario, address);
+	}
+
+	if (server > 0) {
+		kill(server, SIGINT);
+		waitpid(server, nullptr, 0);
+	}
+	return 0;
+}
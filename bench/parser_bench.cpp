@@ -0,0 +1,82 @@
+// Request parser microbenchmark: feeds requests in small slices, the way
+// they arrive from recv(), and reports time and heap allocations per request.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+
+#include "Request.hpp"
+
+static size_t g_allocations = 0;
+
+void* operator new( size_t size ) {
+	++g_allocations;
+	void* ptr = std::malloc(size ? size : 1);
+	if (ptr == nullptr) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void operator delete( void* ptr ) noexcept {
+	std::free(ptr);
+}
+
+void operator delete( void* ptr, size_t ) noexcept {
+	std::free(ptr);
+}
+
+static const std::string g_request =
+	"GET /dir/page1.html?user=42&lang=en HTTP/1.1\r\n"
+	"Host: example.com\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko)\r\n"
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+	"Accept-Language: en-US,en;q=0.5\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Connection: keep-alive\r\n"
+	"Cookie: session=0123456789abcdef0123456789abcdef; theme=dark\r\n"
+	"Upgrade-Insecure-Requests: 1\r\n"
+	"\r\n";
+
+static void runBench( size_t slice_size, size_t iterations ) {
+	Request request;
+	size_t checksum = 0;
+	size_t allocations_before = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i <= iterations; ++i) {
+		if (i == 1) {
+			// the first request warms up the reusable buffers
+			allocations_before = g_allocations;
+			start = std::chrono::steady_clock::now();
+		}
+		for (size_t pos = 0; pos < g_request.size(); pos += slice_size) {
+			request.raw.append(g_request, pos, slice_size);
+			if (request.status == NEW) {
+				request.status = request.parseRequest();
+			}
+		}
+		if (request.status != FULL_BODY) {
+			std::cerr << "parse failed" << std::endl;
+			std::exit(1);
+		}
+		checksum += request.getPath().size() + request.getQuery().size()
+					+ request.getHeader("host").size();
+		request.reset();
+	}
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	double ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+	double allocations = static_cast<double>(g_allocations - allocations_before) / iterations;
+	std::cout << "slice " << slice_size << " bytes: " << ns << " ns/request, "
+			  << allocations << " allocations/request (checksum " << checksum << ")" << std::endl;
+}
+
+int main( void ) {
+	const size_t iterations = 200000;
+	std::cout << "Request size: " << g_request.size() << " bytes" << std::endl;
+	for (size_t slice_size : {4096, 512, 64, 7}) {
+		runBench(slice_size, iterations);
+	}
+	return 0;
+}
@@ -0,0 +1,73 @@
+// Location routing microbenchmark: the compiled LocationRouter against the
+// linear scan over locations sorted by length it replaced, for 10 to 10k
+// locations per server.
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "LocationRouter.hpp"
+
+// The previous lookup: first raw prefix match in length order
+static int linearFind( const std::vector<std::string>& sorted_paths, std::string_view path ) {
+	for (size_t i = 0; i < sorted_paths.size(); ++i) {
+		if (path.compare(0, sorted_paths[i].size(), sorted_paths[i]) == 0) {
+			return static_cast<int>(i);
+		}
+	}
+	return -1;
+}
+
+template <typename Lookup>
+static double nsPerLookup( const std::vector<std::string>& requests, size_t rounds, size_t& checksum, Lookup lookup ) {
+	auto start = std::chrono::steady_clock::now();
+	for (size_t round = 0; round < rounds; ++round) {
+		for (const std::string& request : requests) {
+			checksum += lookup(request) + 1;
+		}
+	}
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / (rounds * requests.size());
+}
+
+static void runBench( size_t location_count ) {
+	// shaped like generated tenant configs: /t<n>/api and /t<n>/static
+	// under a catch-all root
+	std::vector<std::string> paths = {"/"};
+	for (size_t i = 1; paths.size() < location_count; ++i) {
+		paths.push_back("/t" + std::to_string(i) + (i % 2 ? "/api" : "/static"));
+	}
+	LocationRouter router;
+	for (size_t i = 0; i < paths.size(); ++i) {
+		router.add(paths[i], false, static_cast<int>(i));
+	}
+	router.compile();
+	std::vector<std::string> sorted_paths = paths;
+	std::stable_sort(sorted_paths.begin(), sorted_paths.end(),
+		[](const std::string& a, const std::string& b) { return a.size() > b.size(); });
+
+	std::mt19937 random(42);
+	std::vector<std::string> requests;
+	for (size_t i = 0; i < 1000; ++i) {
+		const std::string& path = paths[random() % paths.size()];
+		requests.push_back(path + (i % 3 ? "/v1/users/42" : ""));
+	}
+	size_t rounds = std::max<size_t>(1, 200000 / location_count);
+	size_t checksum = 0;
+	double trie = nsPerLookup(requests, rounds * 10, checksum,
+		[&](std::string_view path) { return router.find(path); });
+	double linear = nsPerLookup(requests, rounds, checksum,
+		[&](std::string_view path) { return linearFind(sorted_paths, path); });
+	std::cout << location_count << " locations: trie " << trie << " ns/lookup, linear "
+			  << linear << " ns/lookup (checksum " << checksum << ")" << std::endl;
+}
+
+int main( void ) {
+	for (size_t location_count : {10, 100, 1000, 10000}) {
+		runBench(location_count);
+	}
+	return 0;
+}
@@ -0,0 +1,129 @@
+// Preloaded into webserv by event_bench: counts the I/O and epoll calls made
+// through libc and writes the totals to $SYSCALL_COUNT_OUT at exit.
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <string>
+
+enum Call { RECV, SEND, SENDMSG, READ, WRITE, WRITEV, SENDFILE, SPLICE, EPOLL_WAIT, EPOLL_CTL, ACCEPT, CLOSE, CALL_COUNT };
+
+static const char* g_names[CALL_COUNT] = {
+	"recv", "send", "sendmsg", "read", "write", "writev", "sendfile", "splice", "epoll_wait", "epoll_ctl", "accept", "close"
+};
+static std::atomic<unsigned long> g_counts[CALL_COUNT];
+
+template <typename Function>
+static Function next( const char* name ) {
+	return reinterpret_cast<Function>(dlsym(RTLD_NEXT, name));
+}
+
+extern "C" {
+
+ssize_t recv( int fd, void* buf, size_t len, int flags ) {
+	static auto real = next<ssize_t (*)(int, void*, size_t, int)>("recv");
+	++g_counts[RECV];
+	return real(fd, buf, len, flags);
+}
+
+ssize_t send( int fd, const void* buf, size_t len, int flags ) {
+	static auto real = next<ssize_t (*)(int, const void*, size_t, int)>("send");
+	++g_counts[SEND];
+	return real(fd, buf, len, flags);
+}
+
+ssize_t sendmsg( int fd, const msghdr* msg, int flags ) {
+	static auto real = next<ssize_t (*)(int, const msghdr*, int)>("sendmsg");
+	++g_counts[SENDMSG];
+	return real(fd, msg, flags);
+}
+
+ssize_t read( int fd, void* buf, size_t count ) {
+	static auto real = next<ssize_t (*)(int, void*, size_t)>("read");
+	++g_counts[READ];
+	return real(fd, buf, count);
+}
+
+ssize_t write( int fd, const void* buf, size_t count ) {
+	static auto real = next<ssize_t (*)(int, const void*, size_t)>("write");
+	++g_counts[WRITE];
+	return real(fd, buf, count);
+}
+
+ssize_t writev( int fd, const iovec* iov, int iovcnt ) {
+	static auto real = next<ssize_t (*)(int, const iovec*, int)>("writev");
+	++g_counts[WRITEV];
+	return real(fd, iov, iovcnt);
+}
+
+ssize_t sendfile( int out_fd, int in_fd, off_t* offset, size_t count ) {
+	static auto real = next<ssize_t (*)(int, int, off_t*, size_t)>("sendfile");
+	++g_counts[SENDFILE];
+	return real(out_fd, in_fd, offset, count);
+}
+
+ssize_t splice( int fd_in, loff_t* off_in, int fd_out, loff_t* off_out, size_t len, unsigned int flags ) {
+	static auto real = next<ssize_t (*)(int, loff_t*, int, loff_t*, size_t, unsigned int)>("splice");
+	++g_counts[SPLICE];
+	return real(fd_in, off_in, fd_out, off_out, len, flags);
+}
+
+int epoll_wait( int epfd, epoll_event* events, int maxevents, int timeout ) {
+	static auto real = next<int (*)(int, epoll_event*, int, int)>("epoll_wait");
+	++g_counts[EPOLL_WAIT];
+	return real(epfd, events, maxevents, timeout);
+}
+
+int epoll_ctl( int epfd, int op, int fd, epoll_event* event ) {
+	static auto real = next<int (*)(int, int, int, epoll_event*)>("epoll_ctl");
+	++g_counts[EPOLL_CTL];
+	return real(epfd, op, fd, event);
+}
+
+int accept( int fd, sockaddr* addr, socklen_t* addrlen ) {
+	static auto real = next<int (*)(int, sockaddr*, socklen_t*)>("accept");
+	++g_counts[ACCEPT];
+	return real(fd, addr, addrlen);
+}
+
+int accept4( int fd, sockaddr* addr, socklen_t* addrlen, int flags ) {
+	static auto real = next<int (*)(int, sockaddr*, socklen_t*, int)>("accept4");
+	++g_counts[ACCEPT];
+	return real(fd, addr, addrlen, flags);
+}
+
+int close( int fd ) {
+	static auto real = next<int (*)(int)>("close");
+	++g_counts[CLOSE];
+	return real(fd);
+}
+
+}
+
+// One "name count" line per call, written with the real write() so the
+// report does not count itself
+__attribute__((destructor))
+static void report( void ) {
+	const char* path = std::getenv("SYSCALL_COUNT_OUT");
+	if (path == nullptr) {
+		return;
+	}
+	std::string out;
+	for (int i = 0; i < CALL_COUNT; ++i) {
+		out += std::string(g_names[i]) + " " + std::to_string(g_counts[i].load()) + "\n";
+	}
+	auto real_write = next<ssize_t (*)(int, const void*, size_t)>("write");
+	auto real_close = next<int (*)(int)>("close");
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd != -1) {
+		ssize_t bytes = real_write(fd, out.data(), out.size());
+		(void)bytes;
+		real_close(fd);
+	}
+}
@@ -0,0 +1,148 @@
+#include <arpa/inet.h>
+#include <charconv>
+#include <ctime>
+#include <netinet/in.h>
+
+#include "AccessLog.hpp"
+
+// 8192 records of 1 KiB, paths are cut to fit
+AccessLog::AccessLog( void ) : _ring(8192, 1024, false), _format(ACCESS_LOG_TEXT) {}
+
+int AccessLog::open( const std::string& path, AccessLogFormat format ) {
+	_format = format;
+	return _ring.setFile(path);
+}
+
+void AccessLog::start( void ) {
+	_ring.start();
+}
+
+void AccessLog::stop( void ) {
+	_ring.stop();
+}
+
+uint64_t AccessLog::dropped( void ) const {
+	return _ring.dropped();
+}
+
+int64_t AccessLog::now( void ) {
+	timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return static_cast<int64_t>(time.tv_sec) * 1000000 + time.tv_nsec / 1000;
+}
+
+void AccessLog::write( const sockaddr_storage& address, const AccessRecord& record ) {
+	thread_local std::string line;
+	line.clear();
+	if (_format == ACCESS_LOG_JSON) {
+		_formatJson(line, address, record);
+	} else {
+		_formatText(line, address, record);
+	}
+	_ring.push(line);
+}
+
+void AccessLog::_appendAddress( std::string& line, const sockaddr_storage& address ) {
+	char buffer[INET6_ADDRSTRLEN];
+	const char* text = nullptr;
+	if (address.ss_family == AF_INET) {
+		const sockaddr_in& in = reinterpret_cast<const sockaddr_in&>(address);
+		text = inet_ntop(AF_INET, &in.sin_addr, buffer, sizeof(buffer));
+	} else if (address.ss_family == AF_INET6) {
+		const sockaddr_in6& in6 = reinterpret_cast<const sockaddr_in6&>(address);
+		text = inet_ntop(AF_INET6, &in6.sin6_addr, buffer, sizeof(buffer));
+	}
+	line += text ? text : "-";
+}
+
+// Quotes and control bytes are escaped, as \" and \u00XX in JSON and as
+// \" and \xXX in text, so a path cannot break the line apart. JSON also
+// escapes every byte >= 0x80, since a raw path need not be valid UTF-8
+void AccessLog::_appendEscaped( std::string& line, std::string_view value, bool json ) {
+	static const char hex[] = "0123456789abcdef";
+	for (unsigned char c : value.substr(0, _max_path)) {
+		if (c == '"' || c == '\\') {
+			line += '\\';
+			line += c;
+		} else if (c < 0x20 || c == 0x7f || (json && c >= 0x80)) {
+			line += json ? "\\u00" : "\\x";
+			line += hex[c >> 4];
+			line += hex[c & 0xf];
+		} else {
+			line += c;
+		}
+	}
+}
+
+static std::string_view methodName( Method method ) {
+	for (const auto& it : Request::methods) {
+		if (method == it.second) {
+			return it.first;
+		}
+	}
+	return "-";
+}
+
+static void appendNumber( std::string& line, int64_t value ) {
+	char buffer[24];
+	auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+	(void)ec;
+	line.append(buffer, end);
+}
+
+// client vhost "METHOD path" status bytes, then the phases as name=usec
+void AccessLog::_formatText( std::string& line, const sockaddr_storage& address, const AccessRecord& record ) const {
+	_appendAddress(line, address);
+	line += ' ';
+	line += record.vhost.empty() ? "-" : record.vhost;
+	line += " \"";
+	line += methodName(record.method);
+	line += ' ';
+	_appendEscaped(line, record.path.empty() ? "-" : record.path, false);
+	line += "\" ";
+	appendNumber(line, record.status);
+	line += ' ';
+	appendNumber(line, record.bytes_sent);
+	const std::pair<const char*, int64_t> phases[] = {
+		{" accept=", record.accepted}, {" headers=", record.headers}, {" route=", record.routed},
+		{" ready=", record.ready}, {" cgi_spawn=", record.cgi_spawn}, {" cgi_exit=", record.cgi_exit},
+		{" done=", record.last_byte}
+	};
+	for (const auto& [name, value] : phases) {
+		line += name;
+		if (value == 0) {
+			line += '-';
+		} else {
+			appendNumber(line, value);
+		}
+	}
+	line += '\n';
+}
+
+// One object per line, phases a request did not go through are left out
+void AccessLog::_formatJson( std::string& line, const sockaddr_storage& address, const AccessRecord& record ) const {
+	line += "{\"client\":\"";
+	_appendAddress(line, address);
+	line += "\",\"vhost\":\"";
+	_appendEscaped(line, record.vhost, true);
+	line += "\",\"method\":\"";
+	line += methodName(record.method);
+	line += "\",\"path\":\"";
+	_appendEscaped(line, record.path, true);
+	line += "\",\"status\":";
+	appendNumber(line, record.status);
+	line += ",\"bytes\":";
+	appendNumber(line, record.bytes_sent);
+	const std::pair<const char*, int64_t> phases[] = {
+		{",\"accept\":", record.accepted}, {",\"headers\":", record.headers}, {",\"route\":", record.routed},
+		{",\"ready\":", record.ready}, {",\"cgi_spawn\":", record.cgi_spawn}, {",\"cgi_exit\":", record.cgi_exit},
+		{",\"done\":", record.last_byte}
+	};
+	for (const auto& [name, value] : phases) {
+		if (value != 0) {
+			line += name;
+			appendNumber(line, value);
+		}
+	}
+	line += "}\n";
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+
+#include "LogRing.hpp"
+#include "Request.hpp"
+
+enum AccessLogFormat {
+	ACCESS_LOG_TEXT,
+	ACCESS_LOG_JSON
+};
+
+// What one request left for the access log. Phases are microseconds of the
+// monotonic clock, 0 for a phase the request did not go through.
+struct AccessRecord {
+	Method				method = UNDEFINED;
+	std::string			path; // only kept while the access log is on
+	std::string_view	vhost; // first server_name of the server that answered
+	int					status = 0;
+	uint64_t			bytes_sent = 0;
+	int64_t				accepted = 0; // the connection, shared by its requests
+	int64_t				headers = 0; // request header block complete
+	int64_t				routed = 0; // location found
+	int64_t				ready = 0; // response queued for sending
+	int64_t				cgi_spawn = 0;
+	int64_t				cgi_exit = 0;
+	int64_t				last_byte = 0;
+};
+
+// One line per request, formatted on the worker and written by the
+// background thread of a LogRing
+class AccessLog {
+private:
+	static const size_t _max_path = 512; // longer paths are cut, the line stays whole
+
+	LogRing			_ring;
+	AccessLogFormat	_format;
+
+	static void _appendAddress( std::string& line, const sockaddr_storage& address );
+	static void _appendEscaped( std::string& line, std::string_view value, bool json );
+	void _formatText( std::string& line, const sockaddr_storage& address, const AccessRecord& record ) const;
+	void _formatJson( std::string& line, const sockaddr_storage& address, const AccessRecord& record ) const;
+
+public:
+	AccessLog( void );
+
+	int open( const std::string& path, AccessLogFormat format );
+	void start( void );
+	void stop( void );
+	void write( const sockaddr_storage& address, const AccessRecord& record );
+	uint64_t dropped( void ) const;
+
+	static int64_t now( void );
+};
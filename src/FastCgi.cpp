@@ -0,0 +1,152 @@
+#include "FastCgi.hpp"
+
+static const size_t header_size = 8;
+static const size_t max_content = 65535;
+
+FastCgiConnection::FastCgiConnection( FastCgiPool& pool, int fd ) : pool(pool), fd(fd) {
+	_next_id = 1;
+	connected = false;
+	multiplexing = false;
+	epoll_events = 0;
+	out_sent = 0;
+	in_parsed = 0;
+}
+
+// Responder role, FCGI_KEEP_CONN so the backend leaves the connection open
+uint16_t FastCgiConnection::beginRequest( int client_fd,
+		const std::vector<std::pair<std::string, std::string>>& params ) {
+	while (_next_id == 0 || requests.find(_next_id) != requests.end()) {
+		++_next_id;
+	}
+	uint16_t request_id = _next_id++;
+	const char begin[8] = {0, 1, 1, 0, 0, 0, 0, 0};
+	_addRecord(FCGI_BEGIN_REQUEST, request_id, std::string_view(begin, sizeof(begin)));
+	std::string content;
+	for (const auto& [name, value] : params) {
+		_addNameValue(content, name, value);
+	}
+	_addRecord(FCGI_PARAMS, request_id, content);
+	_addRecord(FCGI_PARAMS, request_id, "");
+	requests[request_id] = client_fd;
+	return request_id;
+}
+
+// An empty part ends the stream
+void FastCgiConnection::addStdin( uint16_t request_id, std::string_view data ) {
+	_addRecord(FCGI_STDIN, request_id, data);
+}
+
+// The id stays taken until the backend ends the request
+void FastCgiConnection::abortRequest( uint16_t request_id ) {
+	_addRecord(FCGI_ABORT_REQUEST, request_id, "");
+	requests[request_id] = -1;
+}
+
+void FastCgiConnection::getValues( void ) {
+	std::string content;
+	_addNameValue(content, "FCGI_MPXS_CONNS", "");
+	_addRecord(FCGI_GET_VALUES, 0, content);
+}
+
+bool FastCgiConnection::nextRecord( FastCgiRecord& record ) {
+	if (in.size() - in_parsed < header_size) {
+		return false;
+	}
+	const unsigned char* header = reinterpret_cast<const unsigned char*>(in.data() + in_parsed);
+	size_t content_length = (header[4] << 8) | header[5];
+	size_t record_size = header_size + content_length + header[6];
+	if (in.size() - in_parsed < record_size) {
+		return false;
+	}
+	record.type = header[1];
+	record.request_id = (header[2] << 8) | header[3];
+	record.content = std::string_view(in).substr(in_parsed + header_size, content_length);
+	in_parsed += record_size;
+	return true;
+}
+
+// Drops what was written and parsed, only between event handlers since
+// records hold views into in
+void FastCgiConnection::compact( void ) {
+	if (out_sent == out.size()) {
+		out.clear();
+		out_sent = 0;
+	}
+	in.erase(0, in_parsed);
+	in_parsed = 0;
+}
+
+// Without multiplexing a connection carries one request at a time
+bool FastCgiConnection::canBegin( void ) const {
+	return queued.empty() && (requests.empty() || multiplexing);
+}
+
+size_t FastCgiConnection::load( void ) const {
+	return requests.size() + queued.size();
+}
+
+size_t FastCgiConnection::pendingOut( void ) const {
+	return out.size() - out_sent;
+}
+
+std::unordered_map<std::string, std::string> FastCgiConnection::parseNameValues( std::string_view content ) {
+	std::unordered_map<std::string, std::string> values;
+	size_t lengths[2];
+	while (!content.empty()) {
+		for (size_t& length : lengths) {
+			const unsigned char* bytes = reinterpret_cast<const unsigned char*>(content.data());
+			if (content.empty()) {
+				return values;
+			} else if (bytes[0] < 0x80) {
+				length = bytes[0];
+				content.remove_prefix(1);
+			} else if (content.size() >= 4) {
+				length = ((bytes[0] & 0x7f) << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+				content.remove_prefix(4);
+			} else {
+				return values;
+			}
+		}
+		if (content.size() < lengths[0] + lengths[1]) {
+			return values;
+		}
+		values[std::string(content.substr(0, lengths[0]))] = content.substr(lengths[0], lengths[1]);
+		content.remove_prefix(lengths[0] + lengths[1]);
+	}
+	return values;
+}
+
+// Content longer than a record holds is split, empty content still makes
+// one record since it marks the end of a stream
+void FastCgiConnection::_addRecord( uint8_t type, uint16_t request_id, std::string_view content ) {
+	do {
+		std::string_view part = content.substr(0, max_content);
+		size_t padding = (8 - part.size() % 8) % 8;
+		const char header[header_size] = {
+			1,
+			static_cast<char>(type),
+			static_cast<char>(request_id >> 8),
+			static_cast<char>(request_id & 0xff),
+			static_cast<char>(part.size() >> 8),
+			static_cast<char>(part.size() & 0xff),
+			static_cast<char>(padding),
+			0
+		};
+		out.append(header, header_size).append(part).append(padding, '\0');
+		content.remove_prefix(part.size());
+	} while (!content.empty());
+}
+
+void FastCgiConnection::_addNameValue( std::string& content, std::string_view name, std::string_view value ) {
+	for (size_t length : {name.size(), value.size()}) {
+		if (length < 0x80) {
+			content += static_cast<char>(length);
+		} else {
+			content += static_cast<char>((length >> 24) | 0x80);
+			content += static_cast<char>((length >> 16) & 0xff);
+			content += static_cast<char>((length >> 8) & 0xff);
+			content += static_cast<char>(length & 0xff);
+		}
+	}
+	content.append(name).append(value);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// https://fastcgi-archives.github.io/FastCGI_Specification.html
+enum FastCgiType {
+	FCGI_BEGIN_REQUEST = 1,
+	FCGI_ABORT_REQUEST = 2,
+	FCGI_END_REQUEST = 3,
+	FCGI_PARAMS = 4,
+	FCGI_STDIN = 5,
+	FCGI_STDOUT = 6,
+	FCGI_STDERR = 7,
+	FCGI_GET_VALUES = 9,
+	FCGI_GET_VALUES_RESULT = 10
+};
+
+struct FastCgiRecord {
+	uint8_t				type = 0;
+	uint16_t			request_id = 0;
+	std::string_view	content; // points into FastCgiConnection::in
+};
+
+class FastCgiPool;
+
+// One persistent connection to a FastCGI backend. Records are encoded into
+// out and parsed from in, the socket I/O is done by the event loop.
+class FastCgiConnection {
+private:
+	uint16_t	_next_id;
+
+	void _addRecord( uint8_t type, uint16_t request_id, std::string_view content );
+	static void _addNameValue( std::string& content, std::string_view name, std::string_view value );
+
+public:
+	FastCgiConnection( FastCgiPool& pool, int fd );
+
+	FastCgiPool&						pool;
+	int									fd;
+	bool								connected; // the non-blocking connect() finished
+	bool								multiplexing; // the backend reported FCGI_MPXS_CONNS=1
+	uint32_t							epoll_events;
+	std::string							out; // records not written yet
+	size_t								out_sent;
+	std::string							in; // received bytes not parsed yet
+	size_t								in_parsed;
+	std::unordered_map<uint16_t, int>	requests; // request id -> client_fd, -1 once aborted
+	std::deque<int>						queued; // client_fds waiting for the connection
+
+	uint16_t beginRequest( int client_fd, const std::vector<std::pair<std::string, std::string>>& params );
+	void addStdin( uint16_t request_id, std::string_view data );
+	void abortRequest( uint16_t request_id );
+	void getValues( void );
+	bool nextRecord( FastCgiRecord& record );
+	void compact( void );
+	bool canBegin( void ) const;
+	size_t load( void ) const;
+	size_t pendingOut( void ) const;
+	static std::unordered_map<std::string, std::string> parseNameValues( std::string_view content );
+};
+
+// The connections of one worker to one backend address
+class FastCgiPool {
+public:
+	std::string						address;
+	size_t							max_connections = 0;
+	std::list<FastCgiConnection>	connections; // list keeps them at a stable address
+};
@@ -0,0 +1,88 @@
+#include "Histogram.hpp"
+
+Histogram::Histogram( void ) {
+	for (std::atomic<uint64_t>& count : _counts) {
+		count.store(0, std::memory_order_relaxed);
+	}
+	_total.store(0, std::memory_order_relaxed);
+	_sum.store(0, std::memory_order_relaxed);
+	_max.store(0, std::memory_order_relaxed);
+}
+
+void Histogram::record( uint64_t value ) {
+	_add(_counts[_index(value)], 1);
+	_add(_total, 1);
+	_add(_sum, value);
+	if (value > _max.load(std::memory_order_relaxed)) {
+		_max.store(value, std::memory_order_relaxed);
+	}
+}
+
+// Merges into a histogram only this thread writes
+void Histogram::merge( const Histogram& other ) {
+	for (size_t i = 0; i < _bucket_count; ++i) {
+		_add(_counts[i], other._counts[i].load(std::memory_order_relaxed));
+	}
+	_add(_total, other._total.load(std::memory_order_relaxed));
+	_add(_sum, other._sum.load(std::memory_order_relaxed));
+	if (other.max() > max()) {
+		_max.store(other.max(), std::memory_order_relaxed);
+	}
+}
+
+// Upper bound of the bucket holding the given share of the values
+uint64_t Histogram::percentile( double percent ) const {
+	uint64_t total = count();
+	if (total == 0) {
+		return 0;
+	}
+	uint64_t rank = static_cast<uint64_t>(percent / 100.0 * total + 0.5);
+	rank = rank == 0 ? 1 : rank;
+	uint64_t seen = 0;
+	for (size_t i = 0; i < _bucket_count; ++i) {
+		seen += _counts[i].load(std::memory_order_relaxed);
+		if (seen >= rank) {
+			return _upperBound(i) < max() ? _upperBound(i) : max();
+		}
+	}
+	return max();
+}
+
+// Values in buckets ending at or below value
+uint64_t Histogram::countAtMost( uint64_t value ) const {
+	uint64_t seen = 0;
+	for (size_t i = 0; i < _bucket_count && _upperBound(i) <= value; ++i) {
+		seen += _counts[i].load(std::memory_order_relaxed);
+	}
+	return seen;
+}
+
+uint64_t Histogram::count( void ) const {
+	return _total.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::sum( void ) const {
+	return _sum.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::max( void ) const {
+	return _max.load(std::memory_order_relaxed);
+}
+
+// Values below 32 get a bucket each, above that a power of two spans 16
+size_t Histogram::_index( uint64_t value ) {
+	if (value < 2 * _sub_buckets) {
+		return value;
+	}
+	size_t magnitude = 63 - __builtin_clzll(value) - 4;
+	return magnitude * _sub_buckets + (value >> magnitude);
+}
+
+uint64_t Histogram::_upperBound( size_t index ) {
+	if (index < 2 * _sub_buckets) {
+		return index;
+	}
+	size_t magnitude = index / _sub_buckets - 1;
+	uint64_t step = index % _sub_buckets + _sub_buckets;
+	return ((step + 1) << magnitude) - 1;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Log-linear histogram in the spirit of HdrHistogram: values are grouped by
+// power of two and every power is split into 16 linear steps, so any
+// percentile is within ~6% of the recorded value at every magnitude.
+// Written by one thread; other threads may read or merge it meanwhile.
+class Histogram {
+private:
+	static const size_t _sub_buckets = 16;
+	static const size_t _bucket_count = 976; // enough for any uint64_t
+
+	std::array<std::atomic<uint64_t>, _bucket_count>	_counts;
+	std::atomic<uint64_t>								_total;
+	std::atomic<uint64_t>								_sum;
+	std::atomic<uint64_t>								_max;
+
+	// a plain add, the only writer needs no atomic read-modify-write
+	static void _add( std::atomic<uint64_t>& counter, uint64_t value ) {
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	static size_t _index( uint64_t value );
+	static uint64_t _upperBound( size_t index );
+
+public:
+	Histogram( void );
+
+	void record( uint64_t value );
+	void merge( const Histogram& other );
+	uint64_t percentile( double percent ) const;
+	uint64_t countAtMost( uint64_t value ) const;
+	uint64_t count( void ) const;
+	uint64_t sum( void ) const;
+	uint64_t max( void ) const;
+};
@@ -1,20 +1,43 @@
 #pragma once
 
+#include <memory>
 #include <set>
 #include <string>
 #include <unordered_map>
 
 #include "Request.hpp"
 
+class ResponseCache;
+
+enum EtagMode {
+	ETAG_OFF,
+	ETAG_WEAK, // mtime in seconds, for files that are rewritten with the same content
+	ETAG_STRONG // inode, size and mtime in nanoseconds
+};
 
 struct Location {
-	std::string								path;
+	std::string								path; // no trailing '/' except for the root
+	bool									exact = false; // "location = /path:" matches only the path itself
 	std::string								root;
 	std::string								index_page;
 	int										autoindex = -1;
 	size_t									client_max_body_size = SIZE_MAX;
-	std::set<Method>						allowed_methods = {GET, POST, DELETE};
+	std::set<Method>						allowed_methods = {GET, HEAD, POST, DELETE};
 	std::unordered_map<int, std::string>	error_pages;
 	std::string								redirect_path = "";
 	int										redirect_code = 0;
+	size_t									open_cache_size = 0;
+	EtagMode								etag = ETAG_STRONG;
+	bool									gzip = false; // compress text types on the fly
+	size_t									gzip_cache_size = 4194304; // compressed bodies per worker
+	bool									gzip_static = false; // serve .br and .gz files next to the requested one
+	bool									stub_status = false; // answers with the server metrics instead
+	std::string								fastcgi_pass; // backend address, CGI paths go there instead of fork()
+	size_t									fastcgi_connections = 4; // per worker
+	int										client_body_timeout = -1; // seconds, -1 takes the global value
+	int										send_timeout = -1;
+	int										keepalive_timeout = -1;
+	int										cgi_timeout = -1;
+	std::shared_ptr<ResponseCache>			cache; // created per worker when open_cache_size is set
+	std::shared_ptr<ResponseCache>			gzip_cache; // created per worker with gzip, keyed by path and mtime
 };
@@ -0,0 +1,86 @@
+#include "LocationRouter.hpp"
+
+LocationRouter::LocationRouter( void ) {
+	_nodes.emplace_back();
+}
+
+// path starts with '/' and has no trailing '/' unless it is the root.
+// Returns 1 when the path already has a location of this kind.
+int LocationRouter::add( std::string_view path, bool exact, int location ) {
+	size_t index = 0;
+	std::string_view rest = path.substr(1);
+	while (!rest.empty()) {
+		size_t end = rest.find('/');
+		std::string_view segment = rest.substr(0, end);
+		auto it = _nodes[index].children.find(segment);
+		if (it == _nodes[index].children.end()) {
+			_nodes.emplace_back();
+			_nodes.back().label = segment;
+			it = _nodes[index].children.emplace(segment, _nodes.size() - 1).first;
+		}
+		index = it->second;
+		rest.remove_prefix(end == std::string_view::npos ? rest.size() : end + 1);
+	}
+	int& slot = exact ? _nodes[index].exact : _nodes[index].prefix;
+	if (slot != -1) {
+		return 1;
+	}
+	slot = location;
+	return 0;
+}
+
+// Called once all paths were added
+void LocationRouter::compile( void ) {
+	_compress(0);
+}
+
+// A node without a location and with one child is folded into its parent's
+// edge, it could never be the result of a lookup
+void LocationRouter::_compress( size_t index ) {
+	for (auto& [segment, child_index] : _nodes[index].children) {
+		Node& child = _nodes[child_index];
+		while (child.prefix == -1 && child.exact == -1 && child.children.size() == 1) {
+			Node& grandchild = _nodes[child.children.begin()->second];
+			child.label += "/" + grandchild.label;
+			child.prefix = grandchild.prefix;
+			child.exact = grandchild.exact;
+			auto children = std::move(grandchild.children);
+			child.children = std::move(children);
+		}
+		_compress(child_index);
+	}
+}
+
+// Exact match first, then the longest prefix that ends at a segment
+// boundary. Returns -1 when no location matches.
+int LocationRouter::find( std::string_view path ) const {
+	if (path.empty() || path[0] != '/') {
+		return -1;
+	}
+	const Node* node = &_nodes[0];
+	int best = node->prefix;
+	std::string_view rest = path.substr(1);
+	if (rest.empty()) {
+		return node->exact != -1 ? node->exact : best;
+	}
+	while (true) {
+		auto it = node->children.find(rest.substr(0, rest.find('/')));
+		if (it == node->children.end()) {
+			return best;
+		}
+		const Node& child = _nodes[it->second];
+		size_t label_size = child.label.size();
+		if (rest.compare(0, label_size, child.label) != 0
+			|| (rest.size() > label_size && rest[label_size] != '/')) {
+			return best;
+		}
+		node = &child;
+		if (node->prefix != -1) {
+			best = node->prefix;
+		}
+		if (rest.size() == label_size) {
+			return node->exact != -1 ? node->exact : best;
+		}
+		rest.remove_prefix(label_size + 1);
+	}
+}
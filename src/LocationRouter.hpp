@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Location lookup compiled from the paths of one server: a trie of path
+// segments, so /cgi matches /cgi and /cgi/x but not /cgifoo. Chains
+// without a location of their own are merged into one edge. Holds indices
+// into ServerData::locations, so it stays valid when the server is copied.
+class LocationRouter {
+private:
+	struct SegmentHash {
+		using is_transparent = void;
+		size_t operator()( std::string_view segment ) const { return std::hash<std::string_view>{}(segment); }
+	};
+
+	struct Node {
+		std::string	label; // segments below the parent, without the leading '/'
+		int			prefix = -1; // matches the path and everything below it
+		int			exact = -1; // matches the path only
+		std::unordered_map<std::string, size_t, SegmentHash, std::equal_to<>>	children; // by first segment
+	};
+
+	std::vector<Node>	_nodes;
+
+	void _compress( size_t index );
+
+public:
+	LocationRouter( void );
+
+	int add( std::string_view path, bool exact, int location );
+	void compile( void );
+	int find( std::string_view path ) const;
+};
@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+
+#include "LogRing.hpp"
+
+LogRing::LogRing( size_t record_count, size_t record_size, bool report_drops )
+	: _record_count(record_count), _record_size(record_size), _report_drops(report_drops),
+	  _fd(STDOUT_FILENO), _records(new Record[record_count]), _data(new char[record_count * record_size]) {
+	for (size_t i = 0; i < _record_count; ++i) {
+		_records[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	_head.store(0, std::memory_order_relaxed);
+	_tail = 0;
+	_dropped.store(0, std::memory_order_relaxed);
+	_dropped_reported = 0;
+	_running.store(false, std::memory_order_relaxed);
+}
+
+LogRing::~LogRing( void ) {
+	stop();
+	if (_fd != STDOUT_FILENO) {
+		close(_fd);
+	}
+}
+
+// Lines are appended to path instead of stdout
+int LogRing::setFile( const std::string& path ) {
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		return 1;
+	}
+	if (_fd != STDOUT_FILENO) {
+		close(_fd);
+	}
+	_fd = fd;
+	return 0;
+}
+
+void LogRing::start( void ) {
+	if (_running.exchange(true)) {
+		return;
+	}
+	std::cout.flush();
+	_writer = std::thread(&LogRing::_writeLoop, this);
+}
+
+// Writes what is left in the ring. Called once no other thread logs.
+void LogRing::stop( void ) {
+	if (!_running.exchange(false)) {
+		return;
+	}
+	_writer.join();
+}
+
+uint64_t LogRing::dropped( void ) const {
+	return _dropped.load(std::memory_order_relaxed);
+}
+
+size_t LogRing::recordSize( void ) const {
+	return _record_size;
+}
+
+// Claims the next free record, a full ring drops the line
+void LogRing::push( std::string_view line ) {
+	if (!_running.load(std::memory_order_relaxed)) {
+		return _writeAll(line);
+	}
+	size_t position = _head.load(std::memory_order_relaxed);
+	Record* record;
+	while (true) {
+		record = &_records[position & (_record_count - 1)];
+		size_t sequence = record->sequence.load(std::memory_order_acquire);
+		if (sequence == position) {
+			if (_head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (sequence < position) {
+			_dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		} else {
+			position = _head.load(std::memory_order_relaxed);
+		}
+	}
+	char* data = &_data[(position & (_record_count - 1)) * _record_size];
+	if (line.size() > _record_size) {
+		line = line.substr(0, _record_size - 4);
+		std::copy(line.begin(), line.end(), data);
+		std::copy_n("...\n", 4, data + line.size());
+		record->size = _record_size;
+	} else {
+		std::copy(line.begin(), line.end(), data);
+		record->size = line.size();
+	}
+	record->sequence.store(position + 1, std::memory_order_release);
+}
+
+// Sleeps briefly while the ring is empty, so logging never makes a
+// system call on the worker threads
+void LogRing::_writeLoop( void ) {
+	std::string batch;
+	batch.reserve(_batch_size + _record_size);
+	while (true) {
+		bool running = _running.load(std::memory_order_acquire);
+		_drain(batch);
+		uint64_t dropped = _dropped.load(std::memory_order_relaxed);
+		if (_report_drops && dropped != _dropped_reported) {
+			batch += "WARNING: " + std::to_string(dropped - _dropped_reported) + " log records dropped\n";
+			_dropped_reported = dropped;
+		}
+		if (!batch.empty()) {
+			_writeAll(batch);
+			batch.clear();
+		} else if (!running) {
+			return;
+		} else {
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+	}
+}
+
+void LogRing::_drain( std::string& batch ) {
+	while (batch.size() < _batch_size) {
+		size_t index = _tail & (_record_count - 1);
+		Record& record = _records[index];
+		if (record.sequence.load(std::memory_order_acquire) != _tail + 1) {
+			return;
+		}
+		batch.append(&_data[index * _record_size], record.size);
+		record.sequence.store(_tail + _record_count, std::memory_order_release);
+		++_tail;
+	}
+}
+
+void LogRing::_writeAll( std::string_view data ) const {
+	while (!data.empty()) {
+		ssize_t bytes = write(_fd, data.data(), data.size());
+		if (bytes <= 0) {
+			return;
+		}
+		data.remove_prefix(bytes);
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+
+// Lines handed over from any thread through a preallocated lock-free ring
+// of fixed-size records to a background thread, which writes them to a
+// file descriptor in batches. When the ring is full lines are dropped and
+// counted. Before start() and after stop() lines are written directly.
+class LogRing {
+private:
+	static const size_t _batch_size = 65536;
+
+	struct Record {
+		std::atomic<size_t>	sequence; // the position it can be claimed or read at
+		uint32_t			size;
+	};
+
+	size_t							_record_count; // a power of two
+	size_t							_record_size; // longer lines are cut
+	bool							_report_drops; // writes a WARNING line per batch with drops
+	int								_fd;
+	std::unique_ptr<Record[]>		_records;
+	std::unique_ptr<char[]>			_data; // _record_size bytes per record
+	alignas(64) std::atomic<size_t>	_head; // next record to claim, by any thread
+	alignas(64) size_t				_tail; // next record to write, by the writer only
+	std::atomic<uint64_t>			_dropped;
+	uint64_t						_dropped_reported;
+	std::atomic<bool>				_running;
+	std::thread						_writer;
+
+	void _writeLoop( void );
+	void _drain( std::string& batch );
+	void _writeAll( std::string_view data ) const;
+
+public:
+	LogRing( size_t record_count, size_t record_size, bool report_drops );
+	~LogRing( void );
+
+	LogRing( const LogRing& ) = delete;
+	LogRing& operator = ( const LogRing& ) = delete;
+
+	int setFile( const std::string& path );
+	void start( void );
+	void stop( void );
+	void push( std::string_view line );
+	uint64_t dropped( void ) const;
+	size_t recordSize( void ) const;
+};
@@ -1,11 +1,13 @@
 #include "Logger.hpp"
 
-Logger Logger::_instance;
+Logger::Logger( Level level ) : _level(level), _ring(4096, 512, true) {}
 
-Logger::Logger( Level level ) : _level(level) {}
+Logger::~Logger( void ) {}
 
+// Built on first use, since other static instances log while constructed
 Logger& Logger::getInstance( void ) {
-	return _instance;
+	static Logger instance;
+	return instance;
 }
 
 Level Logger::getLevel( void ) const {
@@ -15,22 +17,19 @@ void Logger::setLevel( Level level ) {
 	_level = level;
 }
 
-void Logger::debug( const std::string& msg ) const {
-	if (_level > DEBUG) return;
-	std::cout << "DEBUG: " << msg << std::endl;
+// Records are appended to path instead of stdout
+int Logger::setFile( const std::string& path ) {
+	return _ring.setFile(path);
 }
 
-void Logger::info( const std::string& msg ) const {
-	if (_level > INFO) return;
-	std::cout << "INFO: " << msg << std::endl;
+void Logger::start( void ) {
+	_ring.start();
 }
 
-void Logger::warning( const std::string& msg ) const {
-	if (_level > WARNING) return;
-	std::cout << "WARNING: " << msg << std::endl;
+void Logger::stop( void ) {
+	_ring.stop();
 }
 
-void Logger::error( const std::string& msg ) const {
-	if (_level > ERROR) return;
-	std::cout << "ERROR: " << msg << std::endl;
+uint64_t Logger::dropped( void ) const {
+	return _ring.dropped();
 }
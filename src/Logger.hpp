@@ -1,7 +1,13 @@
 #pragma once
 
+#include <charconv>
+#include <cstdint>
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "LogRing.hpp"
 
 enum Level {
 	DEBUG,
@@ -11,14 +17,20 @@ enum Level {
 	SILENCE
 };
 
+// Messages are passed in parts and only formatted when their level is
+// logged, then handed to a LogRing for the background writer
 class Logger {
 private:
 	Logger( Level level = INFO );
-	~Logger( void ) {};
+	~Logger( void );
 
-	static Logger _instance;
+	Level	_level;
+	LogRing	_ring; // 4096 records of 512 bytes
 
-	Level _level;
+	template <typename T>
+	static void _append( std::string& line, const T& part );
+	template <typename... Args>
+	void _log( Level level, const Args&... parts );
 
 public:
 	Logger( const Logger& ) = delete;
@@ -28,9 +40,42 @@ public:
 
 	Level getLevel( void ) const;
 	void setLevel( Level level );
-	
-	void debug( const std::string& msg ) const;
-	void info( const std::string& msg ) const;
-	void warning( const std::string& msg ) const;
-	void error( const std::string& msg ) const;
-};
\ No newline at end of file
+	int setFile( const std::string& path );
+	void start( void );
+	void stop( void );
+	uint64_t dropped( void ) const;
+
+	template <typename... Args>
+	void debug( const Args&... parts ) { if (_level <= DEBUG) _log(DEBUG, parts...); }
+	template <typename... Args>
+	void info( const Args&... parts ) { if (_level <= INFO) _log(INFO, parts...); }
+	template <typename... Args>
+	void warning( const Args&... parts ) { if (_level <= WARNING) _log(WARNING, parts...); }
+	template <typename... Args>
+	void error( const Args&... parts ) { if (_level <= ERROR) _log(ERROR, parts...); }
+};
+
+// Strings and numbers are appended without temporaries
+template <typename T>
+void Logger::_append( std::string& line, const T& part ) {
+	if constexpr (std::is_same_v<T, char>) {
+		line += part;
+	} else if constexpr (std::is_arithmetic_v<T> && !std::is_same_v<T, bool>) {
+		char buffer[32];
+		auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), part);
+		(void)ec;
+		line.append(buffer, end);
+	} else {
+		line.append(std::string_view(part));
+	}
+}
+
+template <typename... Args>
+void Logger::_log( Level level, const Args&... parts ) {
+	static const char* prefixes[] = {"DEBUG: ", "INFO: ", "WARNING: ", "ERROR: "};
+	thread_local std::string line;
+	line.assign(prefixes[level]);
+	(_append(line, parts), ...);
+	line += '\n';
+	_ring.push(line);
+}
@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <map>
+#include <tuple>
+
+#include "Metrics.hpp"
+#include "ResponseCache.hpp"
+
+static void appendMetric( std::string& out, const char* name, const char* type, const char* help ) {
+	out += "# HELP ";
+	out += name;
+	out += ' ';
+	out += help;
+	out += "\n# TYPE ";
+	out += name;
+	out += ' ';
+	out += type;
+	out += '\n';
+}
+
+static void appendSample( std::string& out, const std::string& name, uint64_t value ) {
+	out += name;
+	out += ' ';
+	out += std::to_string(value);
+	out += '\n';
+}
+
+// Label values escape backslash, quote and newline
+static std::string labelValue( const std::string& value ) {
+	std::string out;
+	for (char c : value) {
+		if (c == '\\' || c == '"') {
+			out += '\\';
+			out += c;
+		} else if (c == '\n') {
+			out += "\\n";
+		} else {
+			out += c;
+		}
+	}
+	return out;
+}
+
+// Every worker has its own copy of each cache, the copies are summed
+static void appendCaches( std::string& out, const std::vector<const WorkerMetrics*>& workers ) {
+	using Key = std::tuple<std::string, std::string, std::string>;
+	std::map<Key, std::array<uint64_t, 4>> caches;
+	for (const WorkerMetrics* worker : workers) {
+		for (const CacheSource& source : worker->caches) {
+			std::array<uint64_t, 4>& sums = caches[Key(source.server, source.location, source.kind)];
+			sums[0] += source.cache->hits();
+			sums[1] += source.cache->misses();
+			sums[2] += source.cache->count();
+			sums[3] += source.cache->size();
+		}
+	}
+	static const char* names[][3] = {
+		{"webserv_cache_hits_total", "counter", "Response cache lookups that found an entry."},
+		{"webserv_cache_misses_total", "counter", "Response cache lookups that found none."},
+		{"webserv_cache_entries", "gauge", "Responses held by the cache."},
+		{"webserv_cache_bytes", "gauge", "Bytes held by the cache."}
+	};
+	for (size_t i = 0; i < 4; ++i) {
+		if (caches.empty()) break;
+		appendMetric(out, names[i][0], names[i][1], names[i][2]);
+		for (const auto& [key, sums] : caches) {
+			appendSample(out, std::string(names[i][0]) + "{server=\"" + labelValue(std::get<0>(key))
+				+ "\",location=\"" + labelValue(std::get<1>(key)) + "\",cache=\"" + std::get<2>(key) + "\"}",
+				sums[i]);
+		}
+	}
+}
+
+// The HDR buckets are finer than these, each bound counts the values of
+// the HDR buckets ending at or below it
+static void appendHistogram( std::string& out, const char* name, const char* help, const Histogram& histogram ) {
+	static const uint64_t bounds[] = {
+		100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+		250000, 500000, 1000000, 2500000, 5000000, 10000000, 30000000
+	};
+	appendMetric(out, name, "histogram", help);
+	for (uint64_t bound : bounds) {
+		out += name;
+		out += "_bucket{le=\"";
+		out += std::to_string(bound / 1e6);
+		while (out.back() == '0') out.pop_back();
+		if (out.back() == '.') out.pop_back();
+		out += "\"} ";
+		out += std::to_string(histogram.countAtMost(bound));
+		out += '\n';
+	}
+	out += name;
+	out += "_bucket{le=\"+Inf\"} " + std::to_string(histogram.count()) + '\n';
+	out += name;
+	out += "_sum " + std::to_string(histogram.sum() / 1e6) + '\n';
+	out += name;
+	out += "_count " + std::to_string(histogram.count()) + '\n';
+}
+
+// Prometheus text exposition format 0.0.4
+// Listen overflows are counted per network namespace, not per worker
+std::string WorkerMetrics::render( const std::vector<const WorkerMetrics*>& workers, uint64_t listen_overflows ) {
+	static const char* states[] = {"idle", "reading", "writing", "cgi"};
+	static const char* timeout_types[] = {"header", "body", "send", "keepalive", "cgi"};
+	uint64_t accepted = 0;
+	uint64_t budget_exhausted = 0;
+	uint64_t queue_peak = 0;
+	uint64_t received = 0;
+	uint64_t sent = 0;
+	std::array<uint64_t, CONN_STATE_COUNT> connections = {};
+	std::array<uint64_t, max_status> requests = {};
+	std::array<uint64_t, TIMEOUT_TYPE_COUNT> timeouts = {};
+	uint64_t spawned = 0;
+	uint64_t preforked = 0;
+	Histogram request_time;
+	Histogram cgi_time;
+	Histogram cgi_spawn_time;
+	for (const WorkerMetrics* worker : workers) {
+		accepted += worker->connections_accepted.get();
+		budget_exhausted += worker->accept_budget_exhausted.get();
+		queue_peak = std::max(queue_peak, worker->accept_queue_peak.get());
+		received += worker->bytes_received.get();
+		sent += worker->bytes_sent.get();
+		for (size_t i = 0; i < CONN_STATE_COUNT; ++i) {
+			connections[i] += worker->connections[i].get();
+		}
+		for (size_t i = 0; i < max_status; ++i) {
+			requests[i] += worker->requests[i].get();
+		}
+		for (size_t i = 0; i < TIMEOUT_TYPE_COUNT; ++i) {
+			timeouts[i] += worker->timeouts[i].get();
+		}
+		spawned += worker->cgi_spawned.get();
+		preforked += worker->cgi_preforked.get();
+		request_time.merge(worker->request_time);
+		cgi_time.merge(worker->cgi_time);
+		cgi_spawn_time.merge(worker->cgi_spawn_time);
+	}
+
+	std::string out;
+	appendMetric(out, "webserv_connections_accepted_total", "counter", "Client connections accepted.");
+	appendSample(out, "webserv_connections_accepted_total", accepted);
+	appendMetric(out, "webserv_accept_budget_exhausted_total", "counter",
+		"Times a worker stopped accepting with connections still queued.");
+	appendSample(out, "webserv_accept_budget_exhausted_total", budget_exhausted);
+	appendMetric(out, "webserv_accept_queue_peak", "gauge", "Longest accept queue seen on a listener.");
+	appendSample(out, "webserv_accept_queue_peak", queue_peak);
+	appendMetric(out, "webserv_listen_overflows_total", "counter",
+		"Connections the kernel dropped on a full accept queue since the start.");
+	appendSample(out, "webserv_listen_overflows_total", listen_overflows);
+	uint64_t active = 0;
+	for (uint64_t count : connections) {
+		active += count;
+	}
+	appendMetric(out, "webserv_connections_active", "gauge", "Open client connections.");
+	appendSample(out, "webserv_connections_active", active);
+	appendMetric(out, "webserv_connections", "gauge", "Open client connections by state.");
+	for (size_t i = 0; i < CONN_STATE_COUNT; ++i) {
+		appendSample(out, std::string("webserv_connections{state=\"") + states[i] + "\"}", connections[i]);
+	}
+	appendMetric(out, "webserv_requests_total", "counter", "Responses queued, by status code.");
+	for (size_t i = 0; i < max_status; ++i) {
+		if (requests[i] != 0) {
+			appendSample(out, "webserv_requests_total{code=\"" + std::to_string(i) + "\"}", requests[i]);
+		}
+	}
+	appendMetric(out, "webserv_received_bytes_total", "counter", "Bytes read from clients.");
+	appendSample(out, "webserv_received_bytes_total", received);
+	appendMetric(out, "webserv_sent_bytes_total", "counter", "Bytes sent to clients.");
+	appendSample(out, "webserv_sent_bytes_total", sent);
+	appendMetric(out, "webserv_timeouts_total", "counter", "Connections and CGIs timed out, by what they waited for.");
+	for (size_t i = 0; i < TIMEOUT_TYPE_COUNT; ++i) {
+		appendSample(out, std::string("webserv_timeouts_total{type=\"") + timeout_types[i] + "\"}", timeouts[i]);
+	}
+	appendHistogram(out, "webserv_request_duration_seconds",
+		"From the complete request header to the last byte of the response.", request_time);
+	appendHistogram(out, "webserv_cgi_duration_seconds", "From CGI spawn to the end of its output.", cgi_time);
+	appendMetric(out, "webserv_cgi_launches_total", "counter", "CGIs started, by how.");
+	appendSample(out, "webserv_cgi_launches_total{how=\"spawned\"}", spawned);
+	appendSample(out, "webserv_cgi_launches_total{how=\"preforked\"}", preforked);
+	appendHistogram(out, "webserv_cgi_launch_duration_seconds",
+		"From the CGI launch until its pipes are in epoll.", cgi_spawn_time);
+	appendCaches(out, workers);
+	return out;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Histogram.hpp"
+
+class ResponseCache;
+
+// A counter owned by one worker thread and read by whichever worker
+// answers a scrape. Its owner adds with a plain load and store.
+class Counter {
+private:
+	std::atomic<uint64_t>	_value;
+
+public:
+	Counter( void ) : _value(0) {}
+
+	void add( uint64_t value = 1 ) {
+		_value.store(_value.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+	void sub( uint64_t value = 1 ) {
+		_value.store(_value.load(std::memory_order_relaxed) - value, std::memory_order_relaxed);
+	}
+	void raise( uint64_t value ) {
+		if (value > get()) _value.store(value, std::memory_order_relaxed);
+	}
+	uint64_t get( void ) const { return _value.load(std::memory_order_relaxed); }
+};
+
+// What a client connection is waiting for, as reported by stub_status
+enum ConnectionState {
+	CONN_IDLE, // between requests
+	CONN_READING, // a request is partly received
+	CONN_WRITING, // responses are queued
+	CONN_CGI, // a CGI or FastCGI backend runs for it
+	CONN_STATE_COUNT
+};
+
+enum TimeoutType {
+	TIMEOUT_HEADER,
+	TIMEOUT_BODY,
+	TIMEOUT_SEND,
+	TIMEOUT_KEEPALIVE,
+	TIMEOUT_CGI,
+	TIMEOUT_TYPE_COUNT
+};
+
+// A response cache of the worker, labelled by its server and location
+struct CacheSource {
+	std::string				server; // first server_name, "_" without one
+	std::string				location;
+	const char*				kind; // "response" or "gzip"
+	const ResponseCache*	cache;
+};
+
+// Counters of one worker, summed over all of them when scraped
+struct WorkerMetrics {
+	static const size_t max_status = 600;
+
+	Counter									connections_accepted;
+	Counter									accept_budget_exhausted; // times connections were left waiting
+	Counter									accept_queue_peak; // longest accept queue seen
+	std::array<Counter, CONN_STATE_COUNT>	connections; // open ones by state
+	std::array<Counter, max_status>			requests; // by status code
+	Counter									bytes_received;
+	Counter									bytes_sent;
+	std::array<Counter, TIMEOUT_TYPE_COUNT>	timeouts;
+	Histogram								request_time; // us, headers complete to last byte
+	Histogram								cgi_time; // us, spawn to exit
+	Counter									cgi_spawned; // launched with posix_spawn()
+	Counter									cgi_preforked; // handed to a parked interpreter
+	Histogram								cgi_spawn_time; // us, launch until the pipes are in epoll
+	std::vector<CacheSource>				caches; // filled before the worker thread starts
+
+	void setState( ConnectionState& current, ConnectionState state ) {
+		if (current != state) {
+			connections[current].sub();
+			connections[state].add();
+			current = state;
+		}
+	}
+
+	static std::string render( const std::vector<const WorkerMetrics*>& workers, uint64_t listen_overflows );
+};
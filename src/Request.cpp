@@ -1,14 +1,37 @@
+#include "Logger.hpp"
 #include "Request.hpp"
 
 const std::unordered_map<std::string, Method> Request::methods = {
 	{"GET", GET},
+	{"HEAD", HEAD},
 	{"POST", POST},
 	{"DELETE", DELETE}
 };
 
+static bool _equalsIgnoreCase( std::string_view a, std::string_view b ) {
+	if (a.size() != b.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < a.size(); ++i) {
+		if (tolower(static_cast<unsigned char>(a[i])) != tolower(static_cast<unsigned char>(b[i]))) {
+			return false;
+		}
+	}
+	return true;
+}
+
 Request::Request( void ) {
 	method = UNDEFINED;
 	status = NEW;
+	content_length = 0;
+	_parse_pos = 0;
+	_body_start = 0;
+	_body_consumed = 0;
+	_request_line_done = false;
+	_chunked = false;
+	_chunk_state = CHUNK_SIZE;
+	_chunk_pos = 0;
+	_chunk_remaining = 0;
 }
 
 Request::Request( const Request& other ) {
@@ -19,120 +42,292 @@ Request& Request::operator = ( const Request& other ) {
 	if (this != &other) {
 		raw = other.raw;
 		method = other.method;
-		path = other.path;
-		params = other.params;
-		headers = other.headers;;
-		body = other.body;
 		status = other.status;
 		content_length = other.content_length;
+		_parse_pos = other._parse_pos;
+		_body_start = other._body_start;
+		_body_consumed = other._body_consumed;
+		_request_line_done = other._request_line_done;
+		_path = other._path;
+		_query = other._query;
+		_headers = other._headers;
+		_chunked = other._chunked;
+		_chunk_state = other._chunk_state;
+		_chunk_pos = other._chunk_pos;
+		_chunk_remaining = other._chunk_remaining;
 	}
 	return (*this);
 }
 
+// Resumes at _parse_pos, so every header byte is scanned once however the
+// block was split between recv() calls. Tokens are stored as offsets
+// into raw, nothing is copied.
 RqStatus Request::parseRequest( void ) {
-	std::istringstream request_stream(raw);
-	std::string line;
-	std::getline(request_stream, line);
-	if (_parseRequestLine(line) != 0) {
-		return INVALID;
-	}
-	while(std::getline(request_stream, line) && line != "\r") {
-		size_t delimiter = line.find(": ");
-		if (delimiter == std::string::npos) {
+	while (true) {
+		size_t line_end = raw.find('\n', _parse_pos);
+		if (line_end == std::string::npos) {
+			return NEW;
+		}
+		size_t line_start = _parse_pos;
+		_parse_pos = line_end + 1;
+		std::string_view line(raw.data() + line_start, line_end - line_start);
+		if (!line.empty() && line.back() == '\r') {
+			line.remove_suffix(1);
+		}
+		if (!_request_line_done) {
+			// empty lines before the request line are ignored (RFC 9112 2.2)
+			if (line.empty()) continue;
+			if (_parseRequestLine(line, line_start) != 0) return INVALID;
+			_request_line_done = true;
+		} else if (line.empty()) {
+			break;
+		} else if (_parseHeaderLine(line, line_start) != 0) {
 			return INVALID;
-		} else if (!line.empty() && line.back() == '\r') {
-			line.pop_back();
 		}
-		std::string key = line.substr(0, delimiter);
-		std::string value = line.substr(delimiter + 2);
-		headers[key] = value;	
-	}
-	if (request_stream) {
-		std::getline(request_stream, raw, '\0');
 	}
-	try {
-		content_length = std::stoull(headers["Content-Length"]);
-	} catch (...) {
-		content_length = 0;
+	_body_start = _parse_pos;
+	if (!getHeader("Transfer-Encoding").empty()) {
+		return _parseTransferEncoding() == 0 ? getRequestBody() : INVALID;
 	}
-	if (request_stream.eof()) {
-		return getRequestBody();
-	}
-	return INVALID;
+	return _parseContentLength() == 0 ? getRequestBody() : INVALID;
 }
 
+// Bytes past the body belong to the next pipelined request and stay in raw
 RqStatus Request::getRequestBody( void ) {
-	if (raw.size() == content_length) {
-		body = raw;
-		return FULL_BODY;
-	} else if (raw.size() < content_length) {
+	if (_chunked) {
+		return _decodeChunks();
+	}
+	if (raw.size() - _body_start < content_length - _body_consumed) {
 		return FULL_HEADER;
 	}
-	return INVALID;
+	return FULL_BODY;
+}
+
+// Drops the answered message but keeps a pipelined next request and the
+// allocated buffers, so a persistent connection parses without allocating
+void Request::reset( void ) {
+	size_t message_end = raw.size();
+	if (status == FULL_BODY) {
+		message_end = _bodyEnd();
+	}
+	raw.erase(0, message_end);
+	method = UNDEFINED;
+	status = NEW;
+	content_length = 0;
+	_parse_pos = 0;
+	_body_start = 0;
+	_body_consumed = 0;
+	_request_line_done = false;
+	_path = Span();
+	_query = Span();
+	_headers.clear();
+	_chunked = false;
+	_chunk_state = CHUNK_SIZE;
+	_chunk_pos = 0;
+	_chunk_remaining = 0;
 }
 
-int Request::_parseRequestLine( const std::string& line ) {
-	size_t space1 = line.find(" ");
-	size_t space2 = line.rfind(" ");
-	if (space1 == space2 || line.substr(space2) != " HTTP/1.1\r") {
+// Drops body bytes that were passed on (to a CGI), so a large upload
+// never has to sit in raw as a whole
+void Request::consumeBody( size_t bytes ) {
+	raw.erase(_body_start, bytes);
+	_body_consumed += bytes;
+	if (_chunked) {
+		_chunk_pos -= bytes;
+	}
+}
+
+bool Request::isChunked( void ) const {
+	return _chunked;
+}
+
+// End in raw of the body bytes received (decoded) and not consumed yet
+size_t Request::_bodyEnd( void ) const {
+	return std::min<uint64_t>(raw.size(), _body_start + content_length - _body_consumed);
+}
+
+// A length that is not all digits, or repeated with another value, would
+// let the body be read as the next pipelined request (RFC 9112 6.3)
+int Request::_parseContentLength( void ) {
+	bool found = false;
+	for (const HeaderSpan& header : _headers) {
+		if (!_equalsIgnoreCase(_view(header.name), "Content-Length")) continue;
+		std::string_view value = _view(header.value);
+		while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+			value.remove_prefix(1);
+		}
+		while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) {
+			value.remove_suffix(1);
+		}
+		uint64_t length;
+		auto result = std::from_chars(value.data(), value.data() + value.size(), length);
+		if (value.empty() || result.ec != std::errc() || result.ptr != value.data() + value.size()
+			|| (found && length != content_length)) {
+			return 1;
+		}
+		content_length = length;
+		found = true;
+	}
+	return 0;
+}
+
+// Only chunked is supported, and together with Content-Length it would
+// make the message length ambiguous (RFC 9112 6.3)
+int Request::_parseTransferEncoding( void ) {
+	if (!_equalsIgnoreCase(getHeader("Transfer-Encoding"), "chunked")
+		|| !getHeader("Content-Length").empty()) {
 		return 1;
 	}
-	auto it = methods.find(line.substr(0, space1));
-	if (it != methods.end()) {
-		method = it->second;
-	} else {
+	_chunked = true;
+	_chunk_pos = _body_start;
+	content_length = 0;
+	return 0;
+}
+
+// Decodes whatever arrived since the last call. Chunk data is moved down
+// over the framing, so raw[_body_start, _bodyEnd()) is always the decoded
+// body and content_length can be checked as it grows.
+RqStatus Request::_decodeChunks( void ) {
+	while (_chunk_state != CHUNK_DONE) {
+		if (_chunk_state == CHUNK_DATA) {
+			size_t available = std::min<uint64_t>(raw.size() - _chunk_pos, _chunk_remaining);
+			if (available == 0) {
+				return FULL_HEADER;
+			}
+			std::memmove(raw.data() + _bodyEnd(), raw.data() + _chunk_pos, available);
+			content_length += available;
+			_chunk_pos += available;
+			_chunk_remaining -= available;
+			if (_chunk_remaining == 0) {
+				_chunk_state = CHUNK_DATA_END;
+			}
+			continue;
+		}
+		size_t line_end = raw.find('\n', _chunk_pos);
+		if (line_end == std::string::npos) {
+			return raw.size() - _chunk_pos > 1024 ? INVALID : FULL_HEADER;
+		}
+		std::string_view line(raw.data() + _chunk_pos, line_end - _chunk_pos);
+		if (!line.empty() && line.back() == '\r') {
+			line.remove_suffix(1);
+		}
+		_chunk_pos = line_end + 1;
+		if (_chunk_state == CHUNK_SIZE) {
+			line = line.substr(0, line.find(';')); // chunk extensions are ignored
+			auto result = std::from_chars(line.data(), line.data() + line.size(), _chunk_remaining, 16);
+			if (line.empty() || result.ec != std::errc() || result.ptr != line.data() + line.size()) {
+				return INVALID;
+			}
+			_chunk_state = _chunk_remaining == 0 ? CHUNK_TRAILER : CHUNK_DATA;
+		} else if (_chunk_state == CHUNK_DATA_END) {
+			if (!line.empty()) {
+				return INVALID;
+			}
+			_chunk_state = CHUNK_SIZE;
+		} else if (line.empty()) {
+			_chunk_state = CHUNK_DONE; // trailer fields are skipped
+		}
+	}
+	// drop the leftover framing so a pipelined request follows the body
+	size_t body_end = _bodyEnd();
+	raw.erase(body_end, _chunk_pos - body_end);
+	_chunk_pos = body_end;
+	return FULL_BODY;
+}
+
+int Request::_parseRequestLine( std::string_view line, size_t offset ) {
+	size_t space1 = line.find(' ');
+	size_t space2 = line.rfind(' ');
+	if (space1 == std::string_view::npos || space1 == space2 || line.substr(space2) != " HTTP/1.1") {
+		return 1;
+	}
+	std::string_view method_str = line.substr(0, space1);
+	method = UNDEFINED;
+	for (const auto& [name, value] : methods) {
+		if (method_str == name) {
+			method = value;
+			break;
+		}
+	}
+	if (method == UNDEFINED) {
+		return 1;
+	}
+	return _parseTarget(line.substr(space1 + 1, space2 - space1 - 1), offset + space1 + 1);
+}
+
+int	Request::_parseTarget( std::string_view target, size_t offset ) {
+	if (target.empty() || target[0] != '/') {
 		return 1;
 	}
-	std::string target = line.substr(space1 + 1, space2 - space1 - 1);
-	return _parseTarget(target);
+	size_t delimiter = target.find('?');
+	if (delimiter == std::string_view::npos) {
+		_path = {offset, target.size()};
+	} else {
+		_path = {offset, delimiter};
+		_query = {offset + delimiter + 1, target.size() - delimiter - 1};
+	}
+	return 0;
 }
 
-int	Request::_parseTarget( const std::string& line ) {
-	if (line.empty() || line[0] != '/') {
+int Request::_parseHeaderLine( std::string_view line, size_t offset ) {
+	size_t delimiter = line.find(": ");
+	if (delimiter == std::string_view::npos) {
 		return 1;
 	}
-	size_t	delimiter = line.find("?");
-	path = line.substr(0, delimiter);
-	if (delimiter == std::string::npos) {
-		return 0;
-	}
-	std::istringstream	query_stream(line.substr(delimiter + 1));
-	std::string	param_str;
-	while (std::getline(query_stream, param_str, '&')) {
-		std::string::size_type equal_pos = param_str.find('=');
-		if (equal_pos != std::string::npos) {
-			std::string key = param_str.substr(0, equal_pos);
-			std::string value = param_str.substr(equal_pos + 1);
-			params[key] = value;
-		} else {
-			params[param_str] = "";
+	_headers.push_back({{offset, delimiter}, {offset + delimiter + 2, line.size() - delimiter - 2}});
+	return 0;
+}
+
+std::string_view Request::_view( const Span& span ) const {
+	return std::string_view(raw.data() + span.start, span.size);
+}
+
+std::string_view Request::getPath( void ) const {
+	return _view(_path);
+}
+
+std::string_view Request::getQuery( void ) const {
+	return _view(_query);
+}
+
+std::string_view Request::getBody( void ) const {
+	if (raw.size() < _body_start) {
+		return std::string_view();
+	}
+	return std::string_view(raw.data() + _body_start, _bodyEnd() - _body_start);
+}
+
+// Header names are case-insensitive, a repeated header returns its last value
+std::string_view Request::getHeader( std::string_view name ) const {
+	for (auto it = _headers.rbegin(); it != _headers.rend(); ++it) {
+		if (_equalsIgnoreCase(_view(it->name), name)) {
+			return _view(it->value);
 		}
 	}
-	if (query_stream.eof()) {
-		return 0;
+	return std::string_view();
+}
+
+std::vector<std::pair<std::string_view, std::string_view>> Request::getHeaders( void ) const {
+	std::vector<std::pair<std::string_view, std::string_view>> headers;
+	for (const HeaderSpan& header : _headers) {
+		headers.emplace_back(_view(header.name), _view(header.value));
 	}
-	return 1;
+	return headers;
 }
 
+// One record per header keeps each under the logger's record size
 void Request::printRequest( void ) const {
-	std::cout << "\033[32m" << "_______\nREQUEST" << std::endl;
-	std::string method_str = "";
+	Logger& logger = Logger::getInstance();
+	std::string_view method_str;
 	for (const auto& it : methods) {
 		if (method == it.second) {
 			method_str = it.first;
 			break;
 		}
 	}
-	std::cout << "Method: " << method_str << std::endl;
-	std::cout << "Path: '" << path << "'\n";
-	std::cout << "\nParams: " << std::endl;
-	for (const auto& it : params) {
-		std::cout << it.first << " = " << it.second << std::endl;
-	}
-	std::cout << "\nHeaders: " << std::endl;
-	for (const auto& it : headers) {
-		std::cout << it.first << ": " << it.second << std::endl;
+	logger.debug("Request: ", method_str, " '", getPath(), "' query '", getQuery(), "', body of ",
+		getBody().size(), " bytes");
+	for (const HeaderSpan& header : _headers) {
+		logger.debug("Request header: ", _view(header.name), ": ", _view(header.value));
 	}
-	std::cout << "\nBody:\n" << body << std::endl;
-	std::cout << "_______" << std::endl << "\033[0m";
 }
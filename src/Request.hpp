@@ -1,15 +1,22 @@
 #pragma once
 
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
-#include <sstream>
+#include <utility>
+#include <vector>
 
 using map_str_str = std::unordered_map<std::string, std::string>;
 
 enum Method {
 	UNDEFINED,
 	GET,
+	HEAD,
 	POST,
 	DELETE
 };
@@ -21,10 +28,48 @@ enum RqStatus {
 	INVALID
 };
 
+enum ChunkState {
+	CHUNK_SIZE,
+	CHUNK_DATA,
+	CHUNK_DATA_END,
+	CHUNK_TRAILER,
+	CHUNK_DONE
+};
+
+// Offset and length of a token inside Request::raw. Offsets stay valid
+// when raw grows, string_views into it would not.
+struct Span {
+	size_t	start = 0;
+	size_t	size = 0;
+};
+
+struct HeaderSpan {
+	Span	name;
+	Span	value;
+};
+
 class Request {
 private:
-	int _parseRequestLine( const std::string& line );
-	int _parseTarget( const std::string& line );
+	size_t					_parse_pos; // first byte of raw not scanned yet
+	size_t					_body_start;
+	uint64_t				_body_consumed; // body bytes already handed on and dropped from raw
+	bool					_request_line_done;
+	Span					_path;
+	Span					_query;
+	std::vector<HeaderSpan>	_headers;
+	bool					_chunked;
+	ChunkState				_chunk_state;
+	size_t					_chunk_pos; // first byte of chunked framing not decoded yet
+	uint64_t				_chunk_remaining;
+
+	int _parseRequestLine( std::string_view line, size_t offset );
+	int _parseTarget( std::string_view target, size_t offset );
+	int _parseHeaderLine( std::string_view line, size_t offset );
+	int _parseContentLength( void );
+	int _parseTransferEncoding( void );
+	RqStatus _decodeChunks( void );
+	size_t _bodyEnd( void ) const;
+	std::string_view _view( const Span& span ) const;
 
 public:
 	Request( void );
@@ -37,15 +82,20 @@ public:
 
 	std::string		raw;
 	Method			method;
-	std::string		path;
-	map_str_str		params;
-	map_str_str		headers;
-	std::string		body;
 	RqStatus		status;
-	uint64_t		content_length;
+	uint64_t		content_length; // for chunked bodies: bytes decoded so far
 
 	RqStatus parseRequest( void );
 	RqStatus getRequestBody( void );
+	void reset( void );
+	void consumeBody( size_t bytes );
+	bool isChunked( void ) const;
+
+	std::string_view getPath( void ) const;
+	std::string_view getQuery( void ) const;
+	std::string_view getBody( void ) const;
+	std::string_view getHeader( std::string_view name ) const;
+	std::vector<std::pair<std::string_view, std::string_view>> getHeaders( void ) const;
 
 	// Debug
 	void printRequest( void ) const;
@@ -2,26 +2,101 @@
 
 Response::Response( void ) : logger(Logger::getInstance()) {
 	location = nullptr;
+	keep_alive = false;
+	header_only = false;
+	file_fd = -1;
+	file_size = 0;
+	streaming = false;
+	chunked_body = false;
+	body_remaining = 0;
+	_front_sent = 0;
+	_pending = 0;
 }
 
 Response::Response( const Response& other ) : logger(Logger::getInstance()) {
+	file_fd = -1;
 	*this = other;
 }
 
+Response::Response( Response&& other ) noexcept : logger(Logger::getInstance()) {
+	file_fd = -1;
+	*this = std::move(other);
+}
+
+Response::~Response( void ) {
+	if (file_fd != -1) {
+		close(file_fd);
+	}
+}
+
 Response& Response::operator = ( const Response& other ) {
 	if (this != &other) {
-		full_response = other.full_response;
+		_segments = other._segments;
+		_front_sent = other._front_sent;
+		_pending = other._pending;
+		cgi_header = other.cgi_header;
+		if (file_fd != -1) {
+			close(file_fd);
+		}
+		file_fd = other.file_fd == -1 ? -1 : fcntl(other.file_fd, F_DUPFD_CLOEXEC, 0);
+		file_size = other.file_size;
 		local_path = other.local_path;
+		range = other.range;
+		if_range = other.if_range;
+		if_none_match = other.if_none_match;
+		if_modified_since = other.if_modified_since;
+		accept_encoding = other.accept_encoding;
+		header_only = other.header_only;
+		location = other.location;
+		keep_alive = other.keep_alive;
+		streaming = other.streaming;
+		chunked_body = other.chunked_body;
+		body_remaining = other.body_remaining;
+		access_record = other.access_record;
+	}
+	return (*this);
+}
+
+Response& Response::operator = ( Response&& other ) noexcept {
+	if (this != &other) {
+		_segments = std::move(other._segments);
+		_front_sent = other._front_sent;
+		_pending = other._pending;
+		other.clearSegments();
+		cgi_header = std::move(other.cgi_header);
+		if (file_fd != -1) {
+			close(file_fd);
+		}
+		file_fd = other.file_fd;
+		file_size = other.file_size;
+		other.file_fd = -1;
+		other.file_size = 0;
+		local_path = std::move(other.local_path);
+		range = std::move(other.range);
+		if_range = std::move(other.if_range);
+		if_none_match = std::move(other.if_none_match);
+		if_modified_since = std::move(other.if_modified_since);
+		accept_encoding = std::move(other.accept_encoding);
+		header_only = other.header_only;
 		location = other.location;
+		keep_alive = other.keep_alive;
+		streaming = other.streaming;
+		chunked_body = other.chunked_body;
+		body_remaining = other.body_remaining;
+		access_record = std::move(other.access_record);
 	}
 	return (*this);
 }
 
-int Response::prepareResponse( const std::string& request_path, size_t status_code ) {
+int Response::prepareResponse( std::string_view request_path, size_t status_code ) {
 	std::string root_path = location->root;
-	std::string file_path = request_path.substr(location->path.size());
+	std::string file_path(request_path.substr(location->path.size()));
 	if (file_path.front() != '/') file_path.insert(0, 1, '/');
 	local_path = _build_path(root_path, file_path);
+	// the cache holds whole files, ranges are read from the file
+	if (range.empty() && _getCachedResponse(status_code)) {
+		return 1;
+	}
 	if (file_path == "/" && !location->index_page.empty()) {
 		if (access(_build_path(root_path, location->index_page).c_str(), F_OK) == 0) {
 			return prepareResponse(_build_path(location->path, location->index_page), 200);
@@ -29,17 +104,24 @@ int Response::prepareResponse( const std::string& request_path, size_t status_co
 	} else if (_checkIfDirectory(file_path)) {
 		return 1;
 	}
-	std::string extension = _getFileExtension(file_path);
-	if (extension == "py" || extension == "php") {
+	if (isCgiPath(file_path)) {
 		return _checkCgiAccess();
 	}
+	std::string extension = _getFileExtension(file_path);
 	_prepareStaticFile(extension, status_code);
 	return 1;
 }
 
+bool Response::isCgiPath( std::string_view request_path ) {
+	std::string extension = _getFileExtension(std::string(request_path));
+	return extension == "py" || extension == "php";
+}
+
 int Response::_checkCgiAccess( void ) {
-	logger.debug("CGI file: " + local_path);
-	if (access(local_path.c_str(), X_OK) == 0) {
+	logger.debug("CGI file: ", local_path);
+	// a FastCGI backend runs the script through its interpreter
+	int mode = location != nullptr && !location->fastcgi_pass.empty() ? R_OK : X_OK;
+	if (access(local_path.c_str(), mode) == 0) {
 		return 0;
 	} else {
 		prepareResponseError(404);
@@ -47,91 +129,232 @@ int Response::_checkCgiAccess( void ) {
 	}
 }
 
+// Only the header is buffered, the file itself is sent with sendfile().
+// HEAD and revalidations are answered from stat() without opening it.
 void Response::_prepareStaticFile(const std::string& extension, size_t status_code ) {
-	std::ifstream file(local_path);
-	if (_isDirectory(local_path) || !file.is_open()) {
-		logger.warning("Failed to open file: " + local_path);
-		prepareResponseError(404);
+	struct stat file_stat;
+	// an encoded variant stands for the whole file, ranges come from the file itself
+	if (status_code == 200 && range.empty() && _prepareEncoded(extension)) {
 		return;
 	}
-	std::stringstream buffer;
-	buffer << file.rdbuf();
-	std::string body = buffer.str();
-	std::string header = _getHtmlHeader(body.size(), status_code, extension);
-	full_response = header + body;
-}
-
-void Response::prepareResponseError( size_t status_code ) {
-	std::string filepath = "";
-	if (location != nullptr) {
-		filepath = _getErrorPagePath(location->error_pages, status_code);
+	if (status_code == 200 && (_isConditional() || (header_only && range.empty()))) {
+		if (stat(local_path.c_str(), &file_stat) == -1 || S_ISDIR(file_stat.st_mode)) {
+			logger.warning("Failed to stat file: ", local_path);
+			prepareResponseError(404);
+			return;
+		}
+		if (_isNotModified(_getEtag(file_stat), file_stat.st_mtime)) {
+			return _prepareNotModified(_getValidatorFields(file_stat) + _getVaryField(extension));
+		} else if (header_only && range.empty()) {
+			file_size = file_stat.st_size;
+			clearSegments();
+			appendOwned(_getStaticHeaderFields(file_stat, status_code, extension) + getConnectionHeader() + "\r\n");
+			return;
+		}
 	}
-	if (!filepath.empty() && _saveResponsePage(filepath, status_code) == 0) {
+	int fd = open(local_path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1 || fstat(fd, &file_stat) == -1 || S_ISDIR(file_stat.st_mode)) {
+		if (fd != -1) {
+			close(fd);
+		}
+		logger.warning("Failed to open file: ", local_path);
+		prepareResponseError(404);
 		return;
 	}
-	filepath = _getErrorPagePath(_error_pages, status_code);
-	if (filepath.empty()) {
-		filepath = _error_pages.at(0);
+	file_size = file_stat.st_size;
+	std::vector<ByteRange> ranges;
+	if (!range.empty() && status_code == 200 && _ifRangeMatches(file_stat) && _parseRanges(ranges)) {
+		if (ranges.empty()) {
+			close(fd);
+			return _prepareRangeNotSatisfiable();
+		}
+		file_fd = fd;
+		return _prepareRanges(ranges, extension, file_stat);
 	}
-	_saveResponsePage(filepath, status_code);
+	if (location->cache && location->cache->fits(file_size)
+		&& _cacheStaticFile(fd, extension, status_code, file_stat)) {
+		return;
+	}
+	file_fd = fd;
+	clearSegments();
+	appendOwned(_getStaticHeaderFields(file_stat, status_code, extension) + getConnectionHeader() + "\r\n");
+	appendFile(0, file_size);
 }
 
-std::string Response::_getErrorPagePath(const map_int_str& error_pages, size_t status_code) {
-	if (error_pages.find(status_code) == error_pages.end()) {
-		return "";
+bool Response::_getCachedResponse( size_t status_code ) {
+	if (!location->cache || status_code != 200) {
+		return false;
+	} else if ((location->gzip || location->gzip_static) && _acceptedEncodings(_getFileExtension(local_path)) != 0) {
+		// the cached identity body is not what this client gets
+		return false;
+	}
+	const CachedResponse* entry = location->cache->get(local_path);
+	if (entry == nullptr) {
+		return false;
 	}
-	const std::string& filepath = error_pages.at(status_code);
-	if (access(filepath.c_str(), R_OK) == 0 && _isDirectory(filepath) == 0) {
-		return filepath;
+	if (_isNotModified(entry->etag, entry->last_modified)) {
+		// the validators and Vary end the cached header
+		_prepareNotModified(entry->header.substr(entry->header.find("Last-Modified: ")));
+		return true;
 	}
-	return "";
+	clearSegments();
+	appendOwned(entry->header + getConnectionHeader() + "\r\n");
+	appendShared(entry->body);
+	return true;
 }
 
-int Response::_saveResponsePage( std::string& filepath, int status_code ) {
-	std::ifstream file(filepath);
-	if (!file.is_open()) {
-		return 1;
+// Reads a small file once, stores it and serves it from memory
+bool Response::_cacheStaticFile( int fd, const std::string& extension, size_t status_code,
+								 const struct stat& file_stat ) {
+	auto body = std::make_shared<std::string>(file_size, '\0');
+	size_t bytes_read = 0;
+	while (bytes_read < file_size) {
+		ssize_t bytes = read(fd, body->data() + bytes_read, file_size - bytes_read);
+		if (bytes <= 0) {
+			lseek(fd, 0, SEEK_SET);
+			return false;
+		}
+		bytes_read += bytes;
 	}
-	std::stringstream buffer;
-	buffer << file.rdbuf();
-	full_response = buffer.str();
-	std::string extension = _getFileExtension(filepath);
-	full_response = _getHtmlHeader(full_response.size(), status_code, extension) + full_response;
-	return 0;
+	close(fd);
+	CachedResponse entry;
+	entry.header = _getStaticHeaderFields(file_stat, status_code, extension);
+	entry.body = std::move(body);
+	entry.etag = _getEtag(file_stat);
+	entry.last_modified = file_stat.st_mtime;
+	clearSegments();
+	appendOwned(entry.header + getConnectionHeader() + "\r\n");
+	appendShared(entry.body);
+	file_size = 0;
+	location->cache->put(local_path, std::move(entry));
+	return true;
+}
+
+// Header fields of a whole static file, the validators and Vary come last
+std::string Response::_getStaticHeaderFields( const struct stat& file_stat, size_t status_code,
+											  const std::string& extension ) {
+	return _getHtmlHeaderFields(file_stat.st_size, status_code, extension) + "Accept-Ranges: bytes\r\n"
+		   + _getValidatorFields(file_stat) + _getVaryField(extension);
 }
 
 std::string Response::_getHtmlHeader( size_t content_length, size_t status_code,
 									  const std::string& extension ) {
+	return _getHtmlHeaderFields(content_length, status_code, extension) + getConnectionHeader() + "\r\n";
+}
+
+std::string Response::_getHtmlHeaderFields( size_t content_length, size_t status_code,
+											const std::string& extension ) {
 	std::string header = "HTTP/1.1 ";
 	if (_response_codes.find(status_code) != _response_codes.end()) {
 		header += _response_codes.at(status_code) + "\r\n";
 	} else {
 		header += std::to_string(status_code) + "\r\n";
 	}
-	std::string content_type;
-	if (_mime_types.find(extension) == _mime_types.end()) {
-		content_type = _mime_types.at("");
-	} else {
-		content_type = _mime_types.at(extension);
-	}
-	header += "Content-Type: " + content_type + "\r\n";
-	header += "Content-Length: " + std::to_string(content_length) + "\r\n\r\n";
+	header += "Content-Type: " + _getMimeType(extension) + "\r\n";
+	header += "Content-Length: " + std::to_string(content_length) + "\r\n";
 	return header;
 }
 
-void Response::handleCgiResponse( void ) {
-	if (full_response.size() < 8 || full_response.compare(0, 8, "Status: ") != 0) {
-		full_response.insert(0, "HTTP/1.1 200 OK\r\n");
-		return;
+std::string Response::getConnectionHeader( void ) const {
+	return keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+}
+
+// Read back from the status line, which every response starts with
+int Response::statusCode( void ) const {
+	if (_segments.empty() || _segments.front().isFile()) {
+		return 0;
 	}
-	std::string status_str = full_response.substr(8, 4);
-	int status_code = _stringToInt(status_str);
-	if (status_code < 100 || status_code > 599 || status_str.back() != ' ') {
+	std::string_view status_line = _segments.front().bytes();
+	int code = 0;
+	if (status_line.size() > 12) {
+		std::from_chars(status_line.data() + 9, status_line.data() + 12, code);
+	}
+	return code;
+}
+
+// Turns the CGI header block in cgi_header into a response header of its
+// own, the body after it is streamed. Returns 1 when an error page replaced
+// the CGI output.
+int Response::handleCgiResponse( void ) {
+	size_t header_end = cgi_header.find("\r\n\r\n");
+	if (header_end == std::string::npos) {
 		prepareResponseError(500);
-	} else if (location != nullptr
-		&& location->error_pages.find(status_code) != location->error_pages.end()) {
-		prepareResponseError(status_code);
+		return 1;
+	}
+	std::string_view cgi_fields(cgi_header.data(), header_end + 2);
+	std::string header;
+	if (cgi_fields.compare(0, 8, "Status: ") != 0) {
+		header = "HTTP/1.1 200 OK\r\n";
+	} else {
+		std::string status_str = cgi_header.substr(8, 4);
+		int status_code = _stringToInt(status_str);
+		if (status_code < 100 || status_code > 599 || status_str.back() != ' ') {
+			prepareResponseError(500);
+			return 1;
+		} else if (location != nullptr
+			&& location->error_pages.find(status_code) != location->error_pages.end()) {
+			prepareResponseError(status_code);
+			return 1;
+		}
+		size_t status_end = cgi_fields.find("\r\n") + 2;
+		header = "HTTP/1.1";
+		header.append(cgi_fields.substr(7, status_end - 7));
+		cgi_fields.remove_prefix(status_end);
+	}
+	size_t length_pos = cgi_fields.find("Content-Length: ");
+	std::string framing;
+	if (length_pos != std::string_view::npos) {
+		int content_length = _stringToInt(std::string(cgi_fields.substr(length_pos + 16, 20)));
+		if (content_length < 0) {
+			prepareResponseError(500);
+			return 1;
+		}
+		chunked_body = false;
+		body_remaining = content_length;
 	} else {
-		full_response.replace(0, 7, "HTTP/1.1");
+		// without a length the body is framed as chunks, so the connection
+		// does not have to be closed to mark its end
+		chunked_body = true;
+		framing = "Transfer-Encoding: chunked\r\n";
+	}
+	header += getConnectionHeader() + framing;
+	header.append(cgi_fields).append("\r\n");
+	appendOwned(std::move(header));
+	streaming = true;
+	appendCgiBody(std::string_view(cgi_header).substr(header_end + 4));
+	cgi_header.clear();
+	return 0;
+}
+
+// Bytes past the announced Content-Length are dropped
+void Response::appendCgiBody( std::string_view data ) {
+	if (data.empty() || header_only) {
+		return;
+	}
+	if (chunked_body) {
+		char size[20];
+		auto [end, ec] = std::to_chars(size, size + sizeof(size), data.size(), 16);
+		(void)ec;
+		append(std::string_view(size, end - size));
+		append("\r\n");
+		append(data);
+		append("\r\n");
+		return;
+	}
+	data = data.substr(0, body_remaining);
+	append(data);
+	body_remaining -= data.size();
+}
+
+// A CGI that sent less than it announced leaves the client waiting for
+// the rest, so the connection is closed after what was sent
+void Response::finishCgiBody( void ) {
+	if (header_only) {
+		// the body of a HEAD response was dropped as it arrived
+	} else if (chunked_body) {
+		append("0\r\n\r\n");
+	} else if (body_remaining > 0) {
+		keep_alive = false;
 	}
+	streaming = false;
 }
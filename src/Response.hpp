@@ -1,61 +1,182 @@
 #pragma once
 
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <ctime>
+#include <deque>
 #include <dirent.h>
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <string>
+#include <string_view>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <unordered_map>
 #include <vector>
 
+#include "AccessLog.hpp"
 #include "Location.hpp"
 #include "Logger.hpp"
+#include "ResponseCache.hpp"
 
 using map_int_str = std::unordered_map<int, std::string>;
 using map_str_str = std::unordered_map<std::string, std::string>;
 
+struct ErrorPage {
+	std::shared_ptr<const std::string>	body;
+	std::string							extension;
+	map_int_str							headers; // serialized header fields per status code
+};
+
+using error_page_table = std::unordered_map<std::string, ErrorPage>; // keyed by file path
+
+enum ContentEncoding {
+	ENCODING_GZIP = 1,
+	ENCODING_BR = 2
+};
+
+struct ByteRange {
+	uint64_t	first;
+	uint64_t	last; // inclusive, as in Content-Range
+};
+
+// A piece of a response on the wire: bytes it owns, a buffer shared with a
+// cache or the error pages, or a range of Response::file_fd
+struct ResponseSegment {
+	std::string							owned;
+	std::shared_ptr<const std::string>	shared; // sent instead of owned when set
+	off_t								file_offset = -1; // a file range when not -1
+	size_t								file_length = 0;
+
+	bool isFile( void ) const { return file_offset != -1; }
+	std::string_view bytes( void ) const { return shared ? std::string_view(*shared) : std::string_view(owned); }
+	size_t size( void ) const { return isFile() ? file_length : bytes().size(); }
+};
+
 class Response {
 private:
 	static const map_int_str _response_codes;
 	static const map_int_str _error_pages;
 	static const map_str_str _mime_types;
+	static const size_t _gzip_min_length; // smaller bodies are sent as they are
+	static std::atomic<std::shared_ptr<const error_page_table>> _loaded_error_pages;
 
 	// Response.cpp
 	int _checkCgiAccess( void );
 	void _prepareStaticFile( const std::string& extension, size_t status_code );
-	std::string _getErrorPagePath(const map_int_str& error_pages, size_t status_code);
-	int _saveResponsePage( std::string& filepath, int status_code );
+	bool _getCachedResponse( size_t status_code );
+	bool _cacheStaticFile( int fd, const std::string& extension, size_t status_code,
+						   const struct stat& file_stat );
+	std::string _getStaticHeaderFields( const struct stat& file_stat, size_t status_code,
+										const std::string& extension );
 	std::string _getHtmlHeader( size_t content_length, size_t status_code,
 								const std::string& extension );
+	static std::string _getHtmlHeaderFields( size_t content_length, size_t status_code,
+											 const std::string& extension );
+
+	// ResponseErrorPages.cpp
+	bool _setErrorPage( const error_page_table& pages, const std::string& filepath, size_t status_code );
+	static void _loadErrorPage( error_page_table& pages, const std::string& filepath, int status_code );
 
 	// ResponseDirectory.cpp
 	bool _checkIfDirectory( const std::string& file_path );
-	int _isDirectory( const std::string& full_path );
+	static int _isDirectory( const std::string& full_path );
 	void _generateDirectoryList( const std::string& file_path );
 	std::string _getEntryLine( struct dirent* entry );
 	void _getEntryStats( const std::string& path, std::string& size, std::string& mod_time );
 
+	// ResponseConditional.cpp
+	bool _isConditional( void ) const;
+	bool _isNotModified( std::string_view etag, time_t last_modified ) const;
+	static bool _etagListMatches( std::string_view list, std::string_view etag );
+	std::string _getEtag( const struct stat& file_stat ) const;
+	std::string _getValidatorFields( const struct stat& file_stat ) const;
+	void _prepareNotModified( const std::string& validator_fields );
+
+	// ResponseEncoding.cpp
+	int _acceptedEncodings( const std::string& extension ) const;
+	static bool _isCompressible( const std::string& extension );
+	std::string _getVaryField( const std::string& extension ) const;
+	bool _prepareEncoded( const std::string& extension );
+	bool _prepareSidecar( const std::string& extension, const char* suffix, const char* encoding );
+	bool _prepareCompressed( const std::string& extension );
+	static bool _gzip( std::string_view data, std::string& compressed );
+
+	// ResponseRanges.cpp
+	bool _ifRangeMatches( const struct stat& file_stat ) const;
+	bool _parseRanges( std::vector<ByteRange>& ranges ) const;
+	void _prepareRanges( const std::vector<ByteRange>& ranges, const std::string& extension,
+						 const struct stat& file_stat );
+	void _prepareRangeNotSatisfiable( void );
+
+	// ResponseSegments.cpp
+	std::deque<ResponseSegment>	_segments;
+	size_t						_front_sent; // bytes of the first segment already sent
+	size_t						_pending; // bytes of all segments not sent yet
+
 	// ResponseUtils.cpp
 	std::string _build_path( const std::string& first, const std::string& second );
-	std::string _getFileExtension( const std::string& filepath );
+	static std::string _getFileExtension( const std::string& filepath );
+	static const std::string& _getMimeType( const std::string& extension );
+	static std::string _getHttpDate( time_t time );
+	static time_t _parseHttpDate( const std::string& date );
 	int _stringToInt( const std::string& str );
 
 
 public:
 	Response( void );
 	Response( const Response& other );
-	~Response( void ) {};
+	Response( Response&& other ) noexcept;
+	~Response( void );
 
 	Response& operator = ( const Response& other );
+	Response& operator = ( Response&& other ) noexcept;
 
-	std::string	full_response;
+	std::string	cgi_header; // CGI output up to the end of its header block
+	int			file_fd; // static file, its ranges are sent with sendfile()
+	size_t		file_size;
 	std::string local_path;
+	std::string	range; // Range header of a GET, served from file offsets
+	std::string	if_range;
+	std::string	if_none_match;
+	std::string	if_modified_since;
+	std::string	accept_encoding;
 	Location*	location;
+	bool		keep_alive;
+	bool		header_only; // HEAD, the body is dropped when the response is queued
+	bool		streaming; // the CGI is still producing the body
+	bool		chunked_body; // CGI body sent with chunked transfer coding
+	uint64_t	body_remaining; // CGI body bytes still due under Content-Length
+	AccessRecord	access_record;
 	Logger&		logger;
 
 	// Response.cpp
-	int prepareResponse( const std::string& file_path, size_t status_code = 200 );
+	int prepareResponse( std::string_view request_path, size_t status_code = 200 );
+	int handleCgiResponse( void );
+	void appendCgiBody( std::string_view data );
+	void finishCgiBody( void );
+	std::string getConnectionHeader( void ) const;
+	int statusCode( void ) const;
+	static bool isCgiPath( std::string_view request_path );
+
+	// ResponseSegments.cpp
+	void clearSegments( void );
+	void append( std::string_view data );
+	void appendOwned( std::string&& data );
+	void appendShared( std::shared_ptr<const std::string> data );
+	void appendFile( off_t offset, size_t length );
+	size_t pendingSize( void ) const;
+	const ResponseSegment* frontFile( size_t& sent ) const;
+	int fillIovec( iovec* iov, int max_count, size_t limit, size_t& total ) const;
+	void consume( size_t bytes );
+	void dropBody( void );
+
+	// ResponseErrorPages.cpp
 	void prepareResponseError( size_t status_code );
-	void handleCgiResponse( void );
+	static void loadErrorPages( const std::vector<std::pair<int, std::string>>& error_pages );
 };
@@ -0,0 +1,124 @@
+#include "ResponseCache.hpp"
+
+ResponseCache::ResponseCache( size_t max_size, int inotify_fd ) {
+	_max_size = max_size;
+	_inotify_fd = inotify_fd;
+}
+
+const CachedResponse* ResponseCache::get( const std::string& key ) {
+	auto it = _entries.find(key);
+	if (it == _entries.end()) {
+		_misses.add();
+		return nullptr;
+	}
+	_hits.add();
+	_lru.splice(_lru.begin(), _lru, it->second);
+	return &it->second->second;
+}
+
+void ResponseCache::put( const std::string& key, CachedResponse&& entry ) {
+	_erase(key);
+	size_t entry_size = _entrySize(key, entry);
+	// without a watch the entry could never be invalidated
+	if (entry_size > _max_size || !_watchDirectory(key)) {
+		return;
+	}
+	while (_size.get() + entry_size > _max_size && !_lru.empty()) {
+		_erase(_lru.back().first);
+	}
+	_lru.emplace_front(key, std::move(entry));
+	_entries[key] = _lru.begin();
+	_size.add(entry_size);
+	_count.add();
+}
+
+// Files bigger than a quarter of the budget are left to sendfile(),
+// so a single large asset cannot flush the whole hot set
+bool ResponseCache::fits( size_t body_size ) const {
+	return body_size <= _max_size / 4;
+}
+
+// A change in a directory also drops the entry cached for the directory
+// itself, which is the index page served for it
+void ResponseCache::invalidate( int wd, const std::string& name ) {
+	auto it = _watches.find(wd);
+	if (it == _watches.end()) {
+		return;
+	}
+	for (const std::string& prefix : it->second) {
+		_erase(prefix + name);
+		_erase(prefix);
+	}
+}
+
+// The watched directory was deleted, moved or replaced by a rename: every
+// entry read through it, subdirectories included, may now be stale
+void ResponseCache::invalidateWatch( int wd ) {
+	auto it = _watches.find(wd);
+	if (it == _watches.end()) {
+		return;
+	}
+	for (const std::string& prefix : it->second) {
+		for (auto entry = _lru.begin(); entry != _lru.end();) {
+			const std::string& key = (entry++)->first;
+			if (key.compare(0, prefix.size(), prefix) == 0) {
+				_erase(key);
+			}
+		}
+	}
+	_watches.erase(it);
+}
+
+// After an inotify queue overflow any entry may have missed its change
+void ResponseCache::clear( void ) {
+	while (!_lru.empty()) {
+		_erase(_lru.back().first);
+	}
+}
+
+void ResponseCache::_erase( const std::string& key ) {
+	auto it = _entries.find(key);
+	if (it == _entries.end()) {
+		return;
+	}
+	_size.sub(_entrySize(key, it->second->second));
+	_count.sub();
+	_lru.erase(it->second);
+	_entries.erase(it);
+}
+
+bool ResponseCache::_watchDirectory( const std::string& key ) {
+	std::string prefix = key.substr(0, key.rfind('/') + 1);
+	std::string directory = prefix.empty() ? "." : prefix;
+	int wd = inotify_add_watch(_inotify_fd, directory.c_str(),
+		IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+		| IN_DELETE_SELF | IN_MOVE_SELF);
+	if (wd == -1) {
+		return false;
+	}
+	std::vector<std::string>& prefixes = _watches[wd];
+	if (std::find(prefixes.begin(), prefixes.end(), prefix) == prefixes.end()) {
+		prefixes.push_back(prefix);
+	}
+	return true;
+}
+
+size_t ResponseCache::_entrySize( const std::string& key, const CachedResponse& entry ) const {
+	return key.size() + entry.header.size() + entry.body->size() + entry.etag.size();
+}
+
+size_t ResponseCache::hits( void ) const {
+	return _hits.get();
+}
+
+size_t ResponseCache::misses( void ) const {
+	return _misses.get();
+}
+
+size_t ResponseCache::size( void ) const {
+	return _size.get();
+}
+
+size_t ResponseCache::count( void ) const {
+	return _count.get();
+}
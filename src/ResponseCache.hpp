@@ -0,0 +1,61 @@
+#pragma once
+
+#include <algorithm>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <string>
+#include <sys/inotify.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Metrics.hpp"
+
+struct CachedResponse {
+	std::string	header; // status line and headers, without Connection and the empty line
+	std::shared_ptr<const std::string>	body; // shared with the responses sending it
+	std::string							etag; // empty when the location sends none
+	time_t								last_modified = 0;
+};
+
+// Byte-budgeted LRU of serialized static responses, keyed by local path.
+// Each worker owns its caches; entries are dropped on inotify events for
+// the directory they were read from. The statistics are Counters, so a
+// stub_status scrape on another worker can read them.
+class ResponseCache {
+private:
+	using entry_list = std::list<std::pair<std::string, CachedResponse>>;
+
+	size_t														_max_size;
+	Counter														_size;
+	int															_inotify_fd;
+	entry_list													_lru; // most recently used first
+	std::unordered_map<std::string, entry_list::iterator>		_entries;
+	std::unordered_map<int, std::vector<std::string>>			_watches; // wd -> directory prefixes
+	Counter														_count;
+	Counter														_hits;
+	Counter														_misses;
+
+	void _erase( const std::string& key );
+	bool _watchDirectory( const std::string& key );
+	size_t _entrySize( const std::string& key, const CachedResponse& entry ) const;
+
+public:
+	ResponseCache( size_t max_size, int inotify_fd );
+	ResponseCache( const ResponseCache& ) = delete;
+	ResponseCache& operator = ( const ResponseCache& ) = delete;
+	~ResponseCache( void ) {};
+
+	const CachedResponse* get( const std::string& key );
+	void put( const std::string& key, CachedResponse&& entry );
+	bool fits( size_t body_size ) const;
+	void invalidate( int wd, const std::string& name );
+	void invalidateWatch( int wd );
+	void clear( void );
+
+	size_t hits( void ) const;
+	size_t misses( void ) const;
+	size_t size( void ) const;
+	size_t count( void ) const;
+};
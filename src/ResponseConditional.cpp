@@ -0,0 +1,65 @@
+#include "Response.hpp"
+
+bool Response::_isConditional( void ) const {
+	return !if_none_match.empty() || !if_modified_since.empty();
+}
+
+// If-None-Match decides when present, If-Modified-Since is only looked at
+// without it
+bool Response::_isNotModified( std::string_view etag, time_t last_modified ) const {
+	if (!if_none_match.empty()) {
+		return _etagListMatches(if_none_match, etag);
+	} else if (!if_modified_since.empty()) {
+		time_t since = _parseHttpDate(if_modified_since);
+		return since != -1 && last_modified <= since;
+	}
+	return false;
+}
+
+// Weak comparison of a comma separated list of entity tags, or "*"
+bool Response::_etagListMatches( std::string_view list, std::string_view etag ) {
+	auto opaque = [](std::string_view tag) {
+		return tag.compare(0, 2, "W/") == 0 ? tag.substr(2) : tag;
+	};
+	while (!list.empty()) {
+		size_t end = list.find(',');
+		std::string_view tag = list.substr(0, end);
+		list.remove_prefix(end == std::string_view::npos ? list.size() : end + 1);
+		while (!tag.empty() && (tag.front() == ' ' || tag.front() == '\t')) tag.remove_prefix(1);
+		while (!tag.empty() && (tag.back() == ' ' || tag.back() == '\t')) tag.remove_suffix(1);
+		if (tag == "*" || (!etag.empty() && opaque(tag) == opaque(etag))) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Empty when the location sends no entity tags
+std::string Response::_getEtag( const struct stat& file_stat ) const {
+	char buffer[64];
+	int size = 0;
+	if (location->etag == ETAG_STRONG) {
+		uint64_t mtime_ns = static_cast<uint64_t>(file_stat.st_mtim.tv_sec) * 1000000000 + file_stat.st_mtim.tv_nsec;
+		size = snprintf(buffer, sizeof(buffer), "\"%lx-%lx-%lx\"", static_cast<unsigned long>(file_stat.st_ino),
+						static_cast<unsigned long>(file_stat.st_size), static_cast<unsigned long>(mtime_ns));
+	} else if (location->etag == ETAG_WEAK) {
+		size = snprintf(buffer, sizeof(buffer), "W/\"%lx-%lx\"", static_cast<unsigned long>(file_stat.st_size),
+						static_cast<unsigned long>(file_stat.st_mtime));
+	}
+	return std::string(buffer, size);
+}
+
+std::string Response::_getValidatorFields( const struct stat& file_stat ) const {
+	std::string fields = "Last-Modified: " + _getHttpDate(file_stat.st_mtime) + "\r\n";
+	std::string etag = _getEtag(file_stat);
+	if (!etag.empty()) {
+		fields += "ETag: " + etag + "\r\n";
+	}
+	return fields;
+}
+
+void Response::_prepareNotModified( const std::string& validator_fields ) {
+	clearSegments();
+	appendOwned("HTTP/1.1 " + _response_codes.at(304) + "\r\n" + validator_fields + getConnectionHeader() + "\r\n");
+	file_size = 0;
+}
@@ -2,12 +2,16 @@
 
 const map_int_str Response::_response_codes = {
 	{200, "200 OK"},
+	{206, "206 Partial Content"},
+	{304, "304 Not Modified"},
 	{400, "400 Bad Request"},
 	{403, "403 Forbidden"},
 	{404, "404 Not Found"},
 	{405, "405 Method Not Allowed"},
 	{413, "413 Request Entity Too Large"},
-	{500, "500 Internal Server Error"}
+	{416, "416 Range Not Satisfiable"},
+	{500, "500 Internal Server Error"},
+	{502, "502 Bad Gateway"}
 };
 
 const map_int_str Response::_error_pages = {
@@ -20,6 +24,11 @@ const map_int_str Response::_error_pages = {
 	{0, "./default_pages/unknown.html"}
 };
 
+std::atomic<std::shared_ptr<const error_page_table>> Response::_loaded_error_pages(
+	std::make_shared<const error_page_table>());
+
+const size_t Response::_gzip_min_length = 256;
+
 const map_str_str Response::_mime_types = {
 	{"html", "text/html"},
 	{"css", "text/css"},
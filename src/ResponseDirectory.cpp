@@ -27,7 +27,7 @@ void Response::_generateDirectoryList( const std::string& file_path ) {
 	DIR *dir = opendir(local_path.c_str());
 	if (dir == nullptr) {
 		prepareResponseError(403);
-		logger.warning("Failed to open directory" + local_path);
+		logger.warning("Failed to open directory", local_path);
 		return;
 	}
 	struct dirent *entry;
@@ -36,8 +36,20 @@ void Response::_generateDirectoryList( const std::string& file_path ) {
 	}
 	closedir(dir);
 	html << "</table>\n</pre><hr></body>\n</html>\n";
-	full_response = "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nContent-Length: ";
-	full_response += std::to_string(html.str().size())+ "\r\n\r\n" + html.str();
+	std::string body = std::move(html).str();
+	// listings change with every file below them, so they are compressed
+	// for each request instead of cached
+	std::string encoding;
+	std::string compressed;
+	if (location->gzip && body.size() >= _gzip_min_length && (_acceptedEncodings("html") & ENCODING_GZIP)
+		&& _gzip(body, compressed)) {
+		body = std::move(compressed);
+		encoding = "Content-Encoding: gzip\r\n";
+	}
+	clearSegments();
+	appendOwned("HTTP/1.1 200 OK\r\nContent-Type: text/html\r\n" + encoding + _getVaryField("html")
+		   + getConnectionHeader() + "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n");
+	appendOwned(std::move(body));
 }
 
 std::string Response::_getEntryLine( struct dirent* entry ) {
@@ -69,9 +81,11 @@ void Response::_getEntryStats( const std::string& path, std::string& size, std::
 		mod_time = "Unknown";
 		return;
 	}
-	struct tm *tm = localtime(&entry_stat.st_mtime);
+	// workers build listings concurrently, localtime()'s static result is shared
+	struct tm tm;
+	localtime_r(&entry_stat.st_mtime, &tm);
 	char timebuf[80];
-	strftime(timebuf, sizeof(timebuf), "%d-%b-%Y %H:%M", tm);
+	strftime(timebuf, sizeof(timebuf), "%d-%b-%Y %H:%M", &tm);
 	mod_time = std::string(timebuf);
 	size = std::to_string(entry_stat.st_size);
 }
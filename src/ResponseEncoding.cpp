@@ -0,0 +1,179 @@
+#include <strings.h>
+#include <zlib.h>
+
+#include "Response.hpp"
+
+// Encodings of Accept-Encoding this response may use, none unless the
+// location compresses and the type is worth it. "q=0" refuses one.
+int Response::_acceptedEncodings( const std::string& extension ) const {
+	if (accept_encoding.empty() || (!location->gzip && !location->gzip_static) || !_isCompressible(extension)) {
+		return 0;
+	}
+	int accepted = 0;
+	int refused = 0;
+	bool any = false;
+	std::string_view list(accept_encoding);
+	while (!list.empty()) {
+		size_t end = list.find(',');
+		std::string_view item = list.substr(0, end);
+		list.remove_prefix(end == std::string_view::npos ? list.size() : end + 1);
+		size_t params = item.find(';');
+		std::string_view name = item.substr(0, params);
+		while (!name.empty() && (name.front() == ' ' || name.front() == '\t')) name.remove_prefix(1);
+		while (!name.empty() && (name.back() == ' ' || name.back() == '\t')) name.remove_suffix(1);
+		double quality = 1;
+		size_t q = params == std::string_view::npos ? params : item.find("q=", params);
+		if (q != std::string_view::npos) {
+			quality = std::strtod(std::string(item.substr(q + 2)).c_str(), nullptr);
+		}
+		int encoding = 0;
+		if (name.size() == 1 && name[0] == '*') {
+			any = quality > 0;
+			continue;
+		} else if (name.size() == 4 && strncasecmp(name.data(), "gzip", 4) == 0) {
+			encoding = ENCODING_GZIP;
+		} else if (name.size() == 2 && strncasecmp(name.data(), "br", 2) == 0) {
+			encoding = ENCODING_BR;
+		}
+		(quality > 0 ? accepted : refused) |= encoding;
+	}
+	if (any) {
+		accepted |= (ENCODING_GZIP | ENCODING_BR) & ~refused;
+	}
+	return accepted & ~refused;
+}
+
+bool Response::_isCompressible( const std::string& extension ) {
+	const std::string& type = _getMimeType(extension);
+	return type.compare(0, 5, "text/") == 0 || type == "application/json";
+}
+
+// Every variant of a type that may be encoded names the header it was
+// chosen by, also the identity one, so caches keep them apart
+std::string Response::_getVaryField( const std::string& extension ) const {
+	if ((location->gzip || location->gzip_static) && _isCompressible(extension)) {
+		return "Vary: Accept-Encoding\r\n";
+	}
+	return "";
+}
+
+// Prefers a precompressed sidecar, br over gzip, then the compressed
+// variant cache. Returns false when the identity file has to be sent.
+bool Response::_prepareEncoded( const std::string& extension ) {
+	int encodings = _acceptedEncodings(extension);
+	if (encodings == 0) {
+		return false;
+	}
+	if (location->gzip_static) {
+		if ((encodings & ENCODING_BR) && _prepareSidecar(extension, ".br", "br")) {
+			return true;
+		} else if ((encodings & ENCODING_GZIP) && _prepareSidecar(extension, ".gz", "gzip")) {
+			return true;
+		}
+	}
+	return location->gzip && (encodings & ENCODING_GZIP) && _prepareCompressed(extension);
+}
+
+// The sidecar has validators of its own, so its ETag differs from the
+// identity file's
+bool Response::_prepareSidecar( const std::string& extension, const char* suffix, const char* encoding ) {
+	int fd = open((local_path + suffix).c_str(), O_RDONLY | O_CLOEXEC);
+	struct stat file_stat;
+	if (fd == -1) {
+		return false;
+	} else if (fstat(fd, &file_stat) == -1 || !S_ISREG(file_stat.st_mode)) {
+		close(fd);
+		return false;
+	}
+	std::string validators = _getValidatorFields(file_stat) + _getVaryField(extension);
+	if (_isNotModified(_getEtag(file_stat), file_stat.st_mtime)) {
+		close(fd);
+		_prepareNotModified(validators);
+		return true;
+	}
+	file_fd = fd;
+	file_size = file_stat.st_size;
+	clearSegments();
+	appendOwned(_getHtmlHeaderFields(file_size, 200, extension) + "Content-Encoding: " + encoding + "\r\n"
+				+ validators + getConnectionHeader() + "\r\n");
+	appendFile(0, file_size);
+	return true;
+}
+
+// Compresses a file once per modification time and serves the cached
+// body after that. Files too big for the cache are sent as they are.
+bool Response::_prepareCompressed( const std::string& extension ) {
+	struct stat file_stat;
+	if (stat(local_path.c_str(), &file_stat) == -1 || !S_ISREG(file_stat.st_mode)
+		|| static_cast<size_t>(file_stat.st_size) < _gzip_min_length
+		|| !location->gzip_cache->fits(file_stat.st_size)) {
+		return false;
+	}
+	std::string key = local_path + "\t" + std::to_string(file_stat.st_mtim.tv_sec) + "."
+					  + std::to_string(file_stat.st_mtim.tv_nsec);
+	const CachedResponse* entry = location->gzip_cache->get(key);
+	CachedResponse compressed;
+	if (entry == nullptr) {
+		int fd = open(local_path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd == -1) {
+			return false;
+		}
+		std::string data(file_stat.st_size, '\0');
+		size_t bytes_read = 0;
+		while (bytes_read < data.size()) {
+			ssize_t bytes = read(fd, data.data() + bytes_read, data.size() - bytes_read);
+			if (bytes <= 0) {
+				break;
+			}
+			bytes_read += bytes;
+		}
+		close(fd);
+		auto body = std::make_shared<std::string>();
+		if (bytes_read < data.size() || !_gzip(data, *body)) {
+			logger.warning("Failed to compress file: ", local_path);
+			return false;
+		}
+		compressed.etag = _getEtag(file_stat);
+		if (!compressed.etag.empty()) {
+			compressed.etag.insert(compressed.etag.size() - 1, "-gzip");
+		}
+		compressed.last_modified = file_stat.st_mtime;
+		compressed.header = _getHtmlHeaderFields(body->size(), 200, extension) + "Content-Encoding: gzip\r\n"
+							+ "Last-Modified: " + _getHttpDate(file_stat.st_mtime) + "\r\n";
+		if (!compressed.etag.empty()) {
+			compressed.header += "ETag: " + compressed.etag + "\r\n";
+		}
+		compressed.header += _getVaryField(extension);
+		compressed.body = std::move(body);
+		entry = &compressed;
+	}
+	if (_isNotModified(entry->etag, entry->last_modified)) {
+		// the validators and Vary end the cached header
+		_prepareNotModified(entry->header.substr(entry->header.find("Last-Modified: ")));
+	} else {
+		clearSegments();
+		appendOwned(entry->header + getConnectionHeader() + "\r\n");
+		appendShared(entry->body);
+	}
+	if (entry == &compressed) {
+		location->gzip_cache->put(key, std::move(compressed));
+	}
+	return true;
+}
+
+bool Response::_gzip( std::string_view data, std::string& compressed ) {
+	z_stream stream = {};
+	// 16 on top of the window bits asks for a gzip wrapper
+	if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		return false;
+	}
+	compressed.resize(deflateBound(&stream, data.size()));
+	stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+	stream.avail_in = data.size();
+	stream.next_out = reinterpret_cast<Bytef*>(compressed.data());
+	stream.avail_out = compressed.size();
+	int ret = deflate(&stream, Z_FINISH);
+	compressed.resize(stream.total_out);
+	deflateEnd(&stream);
+	return ret == Z_STREAM_END;
+}
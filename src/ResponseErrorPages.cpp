@@ -0,0 +1,74 @@
+#include "Response.hpp"
+
+// Serving an error only looks up the preloaded page and shares its body
+void Response::prepareResponseError( size_t status_code ) {
+	std::shared_ptr<const error_page_table> pages = _loaded_error_pages.load();
+	if (location != nullptr) {
+		auto it = location->error_pages.find(status_code);
+		if (it != location->error_pages.end() && _setErrorPage(*pages, it->second, status_code)) {
+			return;
+		}
+	}
+	auto it = _error_pages.find(status_code);
+	if (it != _error_pages.end() && _setErrorPage(*pages, it->second, status_code)) {
+		return;
+	}
+	if (!_setErrorPage(*pages, _error_pages.at(0), status_code)) {
+		clearSegments();
+		appendOwned(_getHtmlHeader(0, status_code, ""));
+	}
+}
+
+bool Response::_setErrorPage( const error_page_table& pages, const std::string& filepath,
+							  size_t status_code ) {
+	auto it = pages.find(filepath);
+	if (it == pages.end()) {
+		return false;
+	}
+	const ErrorPage& page = it->second;
+	auto header = page.headers.find(status_code);
+	clearSegments();
+	if (header != page.headers.end()) {
+		appendOwned(header->second + getConnectionHeader() + "\r\n");
+	} else {
+		appendOwned(_getHtmlHeaderFields(page.body->size(), status_code, page.extension)
+			   + getConnectionHeader() + "\r\n");
+	}
+	appendShared(page.body);
+	return true;
+}
+
+// Reads every configured and default error page once and publishes the
+// new table atomically, responses still holding old bodies keep them alive
+void Response::loadErrorPages( const std::vector<std::pair<int, std::string>>& error_pages ) {
+	auto pages = std::make_shared<error_page_table>();
+	for (const auto& [status_code, filepath] : _error_pages) {
+		_loadErrorPage(*pages, filepath, status_code);
+	}
+	for (const auto& [status_code, filepath] : error_pages) {
+		_loadErrorPage(*pages, filepath, status_code);
+	}
+	_loaded_error_pages.store(pages);
+	Logger::getInstance().debug("Loaded ", pages->size(), " error pages");
+}
+
+void Response::_loadErrorPage( error_page_table& pages, const std::string& filepath, int status_code ) {
+	auto it = pages.find(filepath);
+	if (it == pages.end()) {
+		std::ifstream file(filepath);
+		if (!file.is_open() || _isDirectory(filepath)) {
+			Logger::getInstance().warning("Failed to load error page: ", filepath);
+			return;
+		}
+		std::stringstream buffer;
+		buffer << file.rdbuf();
+		ErrorPage page;
+		page.body = std::make_shared<const std::string>(buffer.str());
+		page.extension = _getFileExtension(filepath);
+		it = pages.emplace(filepath, std::move(page)).first;
+	}
+	if (status_code != 0) {
+		ErrorPage& page = it->second;
+		page.headers[status_code] = _getHtmlHeaderFields(page.body->size(), status_code, page.extension);
+	}
+}
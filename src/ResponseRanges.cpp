@@ -0,0 +1,113 @@
+#include "Response.hpp"
+
+// If-Range only lets the ranges through while the file is unchanged. An
+// entity tag is compared strongly, so a weak one never matches.
+bool Response::_ifRangeMatches( const struct stat& file_stat ) const {
+	if (if_range.empty()) {
+		return true;
+	} else if (if_range.front() == '"') {
+		return location->etag == ETAG_STRONG && if_range == _getEtag(file_stat);
+	}
+	return if_range == _getHttpDate(file_stat.st_mtime);
+}
+
+// Parses "bytes=0-99, 200-, -50" against file_size. Returns false when the
+// header is malformed or asks for too many ranges, the whole file is sent
+// then. Ranges past the end of the file are left out, none left means 416.
+bool Response::_parseRanges( std::vector<ByteRange>& ranges ) const {
+	const size_t max_ranges = 16;
+	std::string_view spec(range);
+	if (spec.compare(0, 6, "bytes=") != 0) {
+		return false;
+	}
+	spec.remove_prefix(6);
+	size_t count = 0;
+	while (!spec.empty()) {
+		size_t end = spec.find(',');
+		std::string_view item = spec.substr(0, end);
+		spec.remove_prefix(end == std::string_view::npos ? spec.size() : end + 1);
+		while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) item.remove_prefix(1);
+		while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) item.remove_suffix(1);
+		size_t dash = item.find('-');
+		if (item.empty()) {
+			continue;
+		} else if (dash == std::string_view::npos || ++count > max_ranges) {
+			return false;
+		}
+		std::string_view first_str = item.substr(0, dash);
+		std::string_view last_str = item.substr(dash + 1);
+		uint64_t first = 0;
+		uint64_t last = 0;
+		auto parse = [](std::string_view str, uint64_t& value) {
+			auto [end, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+			return ec == std::errc() && end == str.data() + str.size();
+		};
+		if ((!first_str.empty() && !parse(first_str, first))
+			|| (!last_str.empty() && !parse(last_str, last))
+			|| (first_str.empty() && last_str.empty())
+			|| (!first_str.empty() && !last_str.empty() && last < first)) {
+			return false;
+		}
+		if (first_str.empty()) {
+			// suffix range: the last bytes of the file
+			if (last == 0 || file_size == 0) {
+				continue;
+			}
+			first = file_size - std::min<uint64_t>(last, file_size);
+			last = file_size - 1;
+		} else if (first >= file_size) {
+			continue;
+		} else if (last_str.empty() || last >= file_size) {
+			last = file_size - 1;
+		}
+		ranges.push_back({first, last});
+	}
+	return count > 0;
+}
+
+// One range is sent as is, several as multipart/byteranges with a part
+// header before each file range
+void Response::_prepareRanges( const std::vector<ByteRange>& ranges, const std::string& extension,
+							   const struct stat& file_stat ) {
+	static std::atomic<uint32_t> boundary_counter;
+	const std::string& content_type = _getMimeType(extension);
+	std::string total = "/" + std::to_string(file_size) + "\r\n";
+	std::string header = "HTTP/1.1 " + _response_codes.at(206) + "\r\n" + _getValidatorFields(file_stat)
+						 + _getVaryField(extension);
+	clearSegments();
+	if (ranges.size() == 1) {
+		const ByteRange& only = ranges.front();
+		header += "Content-Type: " + content_type + "\r\n";
+		header += "Content-Length: " + std::to_string(only.last - only.first + 1) + "\r\n";
+		header += "Content-Range: bytes " + std::to_string(only.first) + "-" + std::to_string(only.last) + total;
+		appendOwned(header + "Accept-Ranges: bytes\r\n" + getConnectionHeader() + "\r\n");
+		appendFile(only.first, only.last - only.first + 1);
+		return;
+	}
+	std::string boundary = std::to_string(boundary_counter.fetch_add(1) + 1);
+	boundary.insert(0, 20 - boundary.size(), '0');
+	std::vector<std::string> parts;
+	size_t content_length = 0;
+	for (const ByteRange& part : ranges) {
+		parts.push_back("\r\n--" + boundary + "\r\nContent-Type: " + content_type + "\r\nContent-Range: bytes "
+						+ std::to_string(part.first) + "-" + std::to_string(part.last) + total + "\r\n");
+		content_length += parts.back().size() + part.last - part.first + 1;
+	}
+	std::string closing = "\r\n--" + boundary + "--\r\n";
+	content_length += closing.size();
+	header += "Content-Type: multipart/byteranges; boundary=" + boundary + "\r\n";
+	header += "Content-Length: " + std::to_string(content_length) + "\r\n";
+	appendOwned(header + "Accept-Ranges: bytes\r\n" + getConnectionHeader() + "\r\n");
+	for (size_t i = 0; i < ranges.size(); ++i) {
+		appendOwned(std::move(parts[i]));
+		appendFile(ranges[i].first, ranges[i].last - ranges[i].first + 1);
+	}
+	appendOwned(std::move(closing));
+}
+
+void Response::_prepareRangeNotSatisfiable( void ) {
+	clearSegments();
+	appendOwned(_getHtmlHeaderFields(0, 416, "") + "Content-Range: bytes */" + std::to_string(file_size)
+				+ "\r\n" + getConnectionHeader() + "\r\n");
+	file_size = 0;
+}
@@ -0,0 +1,112 @@
+#include "Response.hpp"
+
+void Response::clearSegments( void ) {
+	_segments.clear();
+	_front_sent = 0;
+	_pending = 0;
+}
+
+// Appends to the last owned segment unless sending already started on it,
+// so a segment does not grow while its front is dropped
+void Response::append( std::string_view data ) {
+	if (data.empty()) {
+		return;
+	}
+	if (_segments.empty() || _segments.back().isFile() || _segments.back().shared
+		|| (_segments.size() == 1 && _front_sent > 0)) {
+		_segments.emplace_back();
+	}
+	_segments.back().owned.append(data);
+	_pending += data.size();
+}
+
+void Response::appendOwned( std::string&& data ) {
+	if (data.empty()) {
+		return;
+	}
+	_pending += data.size();
+	_segments.emplace_back();
+	_segments.back().owned = std::move(data);
+}
+
+void Response::appendShared( std::shared_ptr<const std::string> data ) {
+	if (!data || data->empty()) {
+		return;
+	}
+	_pending += data->size();
+	_segments.emplace_back();
+	_segments.back().shared = std::move(data);
+}
+
+void Response::appendFile( off_t offset, size_t length ) {
+	if (length == 0) {
+		return;
+	}
+	_pending += length;
+	_segments.emplace_back();
+	_segments.back().file_offset = offset;
+	_segments.back().file_length = length;
+}
+
+size_t Response::pendingSize( void ) const {
+	return _pending;
+}
+
+// The file range to send next, nullptr when memory segments come first
+const ResponseSegment* Response::frontFile( size_t& sent ) const {
+	if (_segments.empty() || !_segments.front().isFile()) {
+		return nullptr;
+	}
+	sent = _front_sent;
+	return &_segments.front();
+}
+
+// Points iov at the memory segments up to the next file range, at most
+// limit bytes. Returns the number of entries, total is their size.
+int Response::fillIovec( iovec* iov, int max_count, size_t limit, size_t& total ) const {
+	int count = 0;
+	total = 0;
+	for (size_t i = 0; i < _segments.size() && count < max_count && total < limit; ++i) {
+		if (_segments[i].isFile()) {
+			break;
+		}
+		std::string_view bytes = _segments[i].bytes().substr(i == 0 ? _front_sent : 0);
+		bytes = bytes.substr(0, limit - total);
+		if (bytes.empty()) {
+			continue;
+		}
+		iov[count].iov_base = const_cast<char*>(bytes.data());
+		iov[count].iov_len = bytes.size();
+		total += bytes.size();
+		++count;
+	}
+	return count;
+}
+
+// Leaves out everything after the header, which is always the first
+// segment, for a HEAD request
+void Response::dropBody( void ) {
+	if (_segments.size() > 1) {
+		_segments.resize(1);
+		_pending = _segments.front().size() - _front_sent;
+	}
+	if (file_fd != -1) {
+		close(file_fd);
+		file_fd = -1;
+	}
+}
+
+// Drops sent bytes, finished segments release their buffers
+void Response::consume( size_t bytes ) {
+	_pending -= bytes;
+	while (bytes > 0 && !_segments.empty()) {
+		size_t left = _segments.front().size() - _front_sent;
+		if (bytes < left) {
+			_front_sent += bytes;
+			return;
+		}
+		bytes -= left;
+		_segments.pop_front();
+		_front_sent = 0;
+	}
+}
@@ -16,11 +16,37 @@ std::string Response::_getFileExtension( const std::string& filepath ) {
 	return filepath.substr(pos + 1);
 }
 
+const std::string& Response::_getMimeType( const std::string& extension ) {
+	auto it = _mime_types.find(extension);
+	return it != _mime_types.end() ? it->second : _mime_types.at("");
+}
+
+// IMF-fixdate, as used by Last-Modified and If-Range
+std::string Response::_getHttpDate( time_t time ) {
+	struct tm tm;
+	char buffer[32];
+	gmtime_r(&time, &tm);
+	size_t size = strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	return std::string(buffer, size);
+}
+
+// Returns -1 when the date is not an IMF-fixdate
+time_t Response::_parseHttpDate( const std::string& date ) {
+	struct tm tm = {};
+	const char* end = strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	if (end == nullptr || *end != '\0') {
+		return -1;
+	}
+	return timegm(&tm);
+}
+
 int Response::_stringToInt( const std::string& str ) {
 	try {
 		int status_code = std::stoi(str);
 		return status_code;
 	} catch (const std::invalid_argument&) {
 		return -1;
+	} catch (const std::out_of_range&) {
+		return -1;
 	}
 }
@@ -0,0 +1,61 @@
+#include "TimerWheel.hpp"
+
+#include <algorithm>
+
+TimerWheel::TimerWheel( int64_t tick_ms ) : _slots(_slot_count) {
+	_tick_ms = tick_ms;
+	_next_tick = 0;
+	_size = 0;
+}
+
+void TimerWheel::start( int64_t now_ms ) {
+	_next_tick = now_ms / _tick_ms;
+}
+
+// Rounded up, a timer never fires before its deadline
+int64_t TimerWheel::tickFor( int64_t deadline_ms ) const {
+	int64_t tick = (deadline_ms + _tick_ms - 1) / _tick_ms;
+	tick = std::max(tick, _next_tick);
+	return std::min(tick, _next_tick + static_cast<int64_t>(_slot_count) - 1);
+}
+
+// Returns the tick the entry fires at, which is earlier than the deadline
+// when the deadline is past the end of the wheel
+int64_t TimerWheel::schedule( int fd, int64_t deadline_ms ) {
+	int64_t tick = tickFor(deadline_ms);
+	_slots[tick % _slot_count].emplace_back(fd, tick);
+	++_size;
+	return tick;
+}
+
+// Moves the entries of every tick up to now_ms to due. After a long stall
+// every slot is due at most once, nothing is scheduled past the wheel.
+void TimerWheel::expire( int64_t now_ms, std::vector<Entry>& due ) {
+	int64_t now_tick = now_ms / _tick_ms;
+	for (size_t turned = 0; _next_tick <= now_tick && turned < _slot_count; ++turned) {
+		std::vector<Entry>& slot = _slots[_next_tick % _slot_count];
+		_size -= slot.size();
+		due.insert(due.end(), slot.begin(), slot.end());
+		slot.clear();
+		++_next_tick;
+	}
+	_next_tick = std::max(_next_tick, now_tick + 1);
+}
+
+// Milliseconds until the first non-empty slot, -1 when there is none
+int TimerWheel::nextTimeout( int64_t now_ms ) const {
+	if (_size == 0) {
+		return -1;
+	}
+	for (size_t i = 0; i < _slot_count; ++i) {
+		int64_t tick = _next_tick + i;
+		if (!_slots[tick % _slot_count].empty()) {
+			return static_cast<int>(std::max<int64_t>(0, tick * _tick_ms - now_ms));
+		}
+	}
+	return -1;
+}
+
+int64_t TimerWheel::tickMs( void ) const {
+	return _tick_ms;
+}
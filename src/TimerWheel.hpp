@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Hashed timing wheel of fds, one slot per tick. Deadlines further out than
+// the wheel turns are parked in the last slot and scheduled again from
+// there. Entries are never removed: the owner keeps the tick it scheduled
+// and ignores entries that do not match it any more.
+class TimerWheel {
+public:
+	using Entry = std::pair<int, int64_t>; // fd, tick
+
+private:
+	static const size_t _slot_count = 512;
+
+	std::vector<std::vector<Entry>>	_slots;
+	int64_t							_tick_ms;
+	int64_t							_next_tick; // first tick not expired yet
+	size_t							_size;
+
+public:
+	explicit TimerWheel( int64_t tick_ms = 100 );
+
+	void start( int64_t now_ms );
+	int64_t tickFor( int64_t deadline_ms ) const;
+	int64_t schedule( int fd, int64_t deadline_ms );
+	void expire( int64_t now_ms, std::vector<Entry>& due );
+	int nextTimeout( int64_t now_ms ) const;
+	int64_t tickMs( void ) const;
+};
@@ -6,10 +6,58 @@ Webserv::Webserv( void ) : logger(Logger::getInstance()) {
 	logger.setLevel(DEBUG);
 	logger.debug("Webserv instance created");
 	_keep_running = true;
+	_reload_requested = false;
+	_worker_id = 0;
+	_worker_threads = 1;
+	_master = this;
 	_epoll_fd = -1;
+	_wake_fd = -1;
+	_inotify_fd = -1;
 	_event_array_size = 16;
+	_edge_triggered = false;
+	_accept_budget = 64;
+	_accept_budget_left = 0;
+	_listen_overflows_start = 0;
+	_pipeline_depth = 16;
 	_chunk_size = 4096;
-	_timeout_period = 5;
+	_cgi_buffer_size = 65536;
+	_client_header_timeout = 5;
+	_client_body_timeout = 5;
+	_send_timeout = 5;
+	_keepalive_timeout = 15;
+	_cgi_timeout = 5;
+	_keepalive_requests = 100;
+	_cgi_prefork = 0;
+}
+
+// Worker instances get their own copy of the parsed config, so every
+// Location* and ServerData* they hand out stays local to their thread
+Webserv::Webserv( const Webserv& master, size_t worker_id ) : logger(Logger::getInstance()) {
+	_keep_running = true;
+	_reload_requested = false;
+	_worker_id = worker_id;
+	_worker_threads = master._worker_threads;
+	_master = &master;
+	_epoll_fd = -1;
+	_wake_fd = -1;
+	_inotify_fd = -1;
+	_event_array_size = master._event_array_size;
+	_edge_triggered = master._edge_triggered;
+	_accept_budget = master._accept_budget;
+	_accept_budget_left = 0;
+	_listen_overflows_start = 0;
+	_pipeline_depth = master._pipeline_depth;
+	_servers = master._servers;
+	_chunk_size = master._chunk_size;
+	_cgi_buffer_size = master._cgi_buffer_size;
+	_client_header_timeout = master._client_header_timeout;
+	_client_body_timeout = master._client_body_timeout;
+	_send_timeout = master._send_timeout;
+	_keepalive_timeout = master._keepalive_timeout;
+	_cgi_timeout = master._cgi_timeout;
+	_keepalive_requests = master._keepalive_requests;
+	_cgi_prefork = master._cgi_prefork;
+	_access_log = master._access_log;
 }
 
 Webserv::~Webserv( void ) {
@@ -24,33 +72,76 @@ int Webserv::startServer( const std::string& config_file ) {
 	if (_parseConfigFile(config_file) != 0) {
 		return 1;
 	}
-	if (_initWebserv() != 0) {
+	_loadErrorPages();
+	logger.start();
+	if (_access_log) _access_log->start();
+	if (_initWorkers() != 0) {
+		if (_access_log) _access_log->stop();
+		logger.stop();
 		return 1;
 	}
+	std::vector<std::thread> threads;
+	for (auto& worker : _workers) {
+		threads.emplace_back(&Webserv::_mainLoop, worker.get());
+	}
 	_mainLoop();
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	if (_access_log) {
+		_access_log->stop();
+		if (_access_log->dropped() > 0) {
+			logger.warning(_access_log->dropped(), " access log records dropped in total");
+		}
+	}
+	if (logger.dropped() > 0) {
+		logger.warning(logger.dropped(), " log records dropped in total");
+	}
+	logger.stop();
 	return 0;
 }
 
+// Called from the signal handler: only async-signal-safe calls below
 void Webserv::_stopServer( void ) {
 	_keep_running = false;
-	for ( const auto& [server_fd, server_ptr] : _server_sockets_map ) {
-		close(server_fd);
+	_wakeUp();
+	for (auto& worker : _workers) {
+		worker->_keep_running = false;
+		worker->_wakeUp();
+	}
+}
+
+void Webserv::_wakeUp( void ) {
+	if (_wake_fd != -1) {
+		uint64_t value = 1;
+		ssize_t bytes = write(_wake_fd, &value, sizeof(value));
+		(void)bytes;
 	}
 }
 
 void Webserv::_mainLoop( void ) {
 	epoll_event events[_event_array_size];
-	time_t last_timeout_check = time(nullptr);
+	_updateClock();
+	_timers.start(_now);
 	while (_keep_running) {
-		int n = epoll_wait(_epoll_fd, events, _event_array_size, _timeout_period * 1000);
-		logger.debug("Epoll got events: " + std::to_string(n));
+		int timeout = _timers.nextTimeout(_now);
+		if (!_cgi_killed.empty() && (timeout == -1 || timeout > _timers.tickMs())) {
+			timeout = _timers.tickMs();
+		}
+		int n = epoll_wait(_epoll_fd, events, _event_array_size, timeout);
+		_updateClock();
+		logger.debug("Epoll got events: ", n);
 		if (n == -1) {
-			if (_keep_running) perror("epoll_wait");
+			if (errno == EINTR) continue;
+			perror("epoll_wait");
 			break;
-		} else if (difftime(time(nullptr), last_timeout_check) >= _timeout_period) {
-			_checkTimeouts();
-			last_timeout_check = time(nullptr);
 		}
+		if (_reload_requested.exchange(false)) {
+			_loadErrorPages();
+		}
+		_expireTimers();
+		_reapCgiProcesses();
+		_accept_budget_left = _accept_budget;
 		for (int i = 0; i < n; ++i) {
 			_handleEvent(events[i]);
 		}
@@ -58,43 +149,142 @@ void Webserv::_mainLoop( void ) {
 	for (const auto &client_pair : _clients_map) {
 		close(client_pair.first);
 	}
+	for (const auto& [server_fd, server_ptr] : _server_sockets_map) {
+		close(server_fd);
+	}
+	for (const auto& [fastcgi_fd, conn] : _fastcgi_map) {
+		close(fastcgi_fd);
+	}
+	_closePreforkPool();
+	_logCacheStats();
+	_logCgiStats();
+	_logAcceptStats();
+	close(_wake_fd);
+	if (_inotify_fd != -1) {
+		close(_inotify_fd);
+	}
 	close(_epoll_fd);
-	if (!_keep_running) logger.info("Interrupted by signal");
+	if (!_keep_running) logger.info("Worker ", _worker_id, " interrupted by signal");
+}
+
+// Every event of one iteration sees the same time
+void Webserv::_updateClock( void ) {
+	auto since_start = std::chrono::steady_clock::now().time_since_epoch();
+	_now = std::chrono::duration_cast<std::chrono::milliseconds>(since_start).count();
 }
 
-void Webserv::_checkTimeouts( void ) {
-	time_t now = time(nullptr);
-	for (auto it = _clients_map.begin(); it != _clients_map.end();) {
-		int client_fd = it->first;
+// A connection that was active since its entry was scheduled is only
+// scheduled again, the others time out
+void Webserv::_expireTimers( void ) {
+	_timers_due.clear();
+	_timers.expire(_now, _timers_due);
+	for (const auto& [client_fd, tick] : _timers_due) {
+		auto it = _clients_map.find(client_fd);
+		if (it == _clients_map.end() || it->second.timer_tick != tick) {
+			continue; // closed, or scheduled again for an earlier deadline
+		}
 		ClientData& client_data = it->second;
-		++it;
-		if (difftime(now, client_data.last_activity) >= _timeout_period) {
-			if (client_data.cgi.pid == 0) {
-				logger.debug("Timeout for client_fd " + std::to_string(client_fd));
-				_closeClientFd(client_fd, nullptr);
-			} else {
-				logger.debug("CGI timeout for client_fd " + std::to_string(client_fd));
-				client_data.last_activity = time(nullptr);
-				client_data.response.prepareResponseError(500);
-				_modifyEpollSocketOut(client_fd);
-				return _closeCgiPipe(client_data.cgi.fd_in, client_data.cgi, nullptr);
-			}
+		client_data.timer_tick = 0;
+		if (client_data.last_activity + _clientTimeout(client_data) > _now) {
+			_scheduleTimeout(client_fd, client_data);
+		} else {
+			_handleTimeout(client_fd);
+		}
+	}
+}
+
+void Webserv::_handleTimeout( int client_fd ) {
+	ClientData& client_data = _clients_map[client_fd];
+	TimeoutType type;
+	_clientTimeout(client_data, &type);
+	_metrics.timeouts[type].add();
+	if (!client_data.cgi.running()) {
+		logger.debug("Timeout for client_fd ", client_fd);
+		return _closeClientFd(client_fd, nullptr);
+	}
+	logger.debug("CGI timeout for client_fd ", client_fd);
+	client_data.last_activity = _now;
+	_abortCgi(client_fd, nullptr);
+}
+
+// Activity only moves last_activity. The wheel entry is replaced only when
+// the deadline got earlier, a later one is picked up when the entry fires.
+void Webserv::_scheduleTimeout( int client_fd, ClientData& client_data ) {
+	int64_t deadline = client_data.last_activity + _clientTimeout(client_data);
+	if (client_data.timer_tick != 0 && client_data.timer_tick <= _timers.tickFor(deadline)) {
+		return;
+	}
+	client_data.timer_tick = _timers.schedule(client_fd, deadline);
+}
+
+// The timeout class follows what the connection waits for, in milliseconds
+int64_t Webserv::_clientTimeout( const ClientData& client_data, TimeoutType* type ) const {
+	const Location* location = client_data.response.location;
+	int seconds = _client_header_timeout;
+	TimeoutType timeout_type = TIMEOUT_HEADER;
+	if (client_data.cgi.running()) {
+		if (client_data.cgi.headers_done) {
+			location = client_data.responses.back().location;
 		}
+		seconds = location ? location->cgi_timeout : _cgi_timeout;
+		timeout_type = TIMEOUT_CGI;
+	} else if (!client_data.responses.empty()) {
+		location = client_data.responses.front().location;
+		seconds = location ? location->send_timeout : _send_timeout;
+		timeout_type = TIMEOUT_SEND;
+	} else if (client_data.request.status == FULL_HEADER) {
+		seconds = location ? location->client_body_timeout : _client_body_timeout;
+		timeout_type = TIMEOUT_BODY;
+	} else if (client_data.requests_served > 0 && client_data.request.raw.empty()) {
+		location = client_data.last_location;
+		seconds = location ? location->keepalive_timeout : _keepalive_timeout;
+		timeout_type = TIMEOUT_KEEPALIVE;
 	}
+	if (type != nullptr) {
+		*type = timeout_type;
+	}
+	return static_cast<int64_t>(seconds) * 1000;
+}
+
+// Killed CGIs are collected by pid, waitpid(-1) would take the children
+// other workers still wait for
+void Webserv::_reapCgiProcesses( void ) {
+	std::erase_if(_cgi_killed, [](pid_t pid) {
+		return waitpid(pid, nullptr, WNOHANG) != 0;
+	});
 }
 
-void Webserv::_getTargetServer(int client_fd, const std::string& host) {
+// Exact name first, then the longest wildcard suffix, then the default
+// server of the listener. The number of lookups depends on the dots in
+// the host, not on how many names the listener has.
+void Webserv::_getTargetServer(int client_fd, std::string_view host) {
 	ClientData& client_data = _clients_map[client_fd];
-	size_t delimiter = host.find(":");
-	std::string hostname = host.substr(0, delimiter);
-	int server_fd = client_data.server_fd;
-	for (ServerData* server : _server_sockets_map[server_fd]) {
-		const std::vector<std::string>& server_names = server->server_names;
-		auto it = std::find(server_names.begin(), server_names.end(), hostname);
-		if (it != server_names.end()) {
-			client_data.server = server;
+	const ListenerData& listener = _server_sockets_map[client_data.server_fd];
+	client_data.server = listener.default_server;
+	if (!host.empty() && host.front() == '[') {
+		host = host.substr(0, host.find(']') + 1);
+	} else {
+		host = host.substr(0, host.find(':'));
+	}
+	if (!host.empty() && host.back() == '.') {
+		host.remove_suffix(1);
+	}
+	char buffer[256];
+	if (host.empty() || host.size() > sizeof(buffer)) {
+		return;
+	}
+	std::transform(host.begin(), host.end(), buffer, ::tolower);
+	std::string_view hostname(buffer, host.size());
+	auto it = listener.names.find(hostname);
+	if (it != listener.names.end()) {
+		client_data.server = it->second;
+		return;
+	}
+	for (size_t dot = hostname.find('.'); dot != std::string_view::npos; dot = hostname.find('.', dot + 1)) {
+		it = listener.wildcard_names.find(hostname.substr(dot));
+		if (it != listener.wildcard_names.end()) {
+			client_data.server = it->second;
 			return;
 		}
 	}
-	client_data.server = _server_sockets_map[server_fd].front();
 }
@@ -2,87 +2,193 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <string_view>
 #include <cstring>
 #include <csignal>
 #include <ctime>
 #include <cstddef>
+#include <climits>
 #include <fcntl.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <spawn.h>
+#include <sys/un.h>
+#include <atomic>
+#include <deque>
 #include <list>
+#include <memory>
 #include <set>
 #include <unordered_map>
 #include <vector>
 #include <algorithm>
+#include <chrono>
+#include <thread>
 
+#include "AccessLog.hpp"
 #include "Config.hpp"
+#include "FastCgi.hpp"
+#include "Histogram.hpp"
 #include "Location.hpp"
+#include "LocationRouter.hpp"
 #include "Logger.hpp"
+#include "Metrics.hpp"
 #include "Response.hpp"
 #include "Request.hpp"
+#include "TimerWheel.hpp"
 
 
 using map_str_str = std::unordered_map<std::string, std::string>;
 
+// Lets string keyed maps be searched with a string_view
+struct StringHash {
+	using is_transparent = void;
+	size_t operator()( std::string_view key ) const { return std::hash<std::string_view>{}(key); }
+};
+
 struct CgiData {
+	pid_t		pid = 0;
+	int			client_fd = 0;
+	int			fd_in = 0;
+	int			fd_out = 0;
+	uint32_t	in_events = EPOLLIN; // registered interest, 0 while removed from epoll
+	uint32_t	out_events = EPOLLOUT;
+	bool		headers_done = false; // its response is queued, the body follows
+	bool		splicing = false; // body moved from fd_in to the client with splice()
+	bool		socket_full = false; // splice() stopped on a full client socket
+	FastCgiConnection*	fastcgi = nullptr; // set instead of pid for a FastCGI backend
+	uint16_t	request_id = 0; // 0 while queued on the FastCGI connection
+	bool		stdin_done = false; // FastCGI body stream ended
+
+	bool running( void ) const { return pid != 0 || fastcgi != nullptr; }
+};
+
+struct CgiProcess {
 	pid_t	pid = 0;
-	int		client_fd = 0;
-	int		fd_in = 0;
-	int		fd_out = 0;
+	int		fd_in = 0; // its stdout
+	int		fd_out = 0; // its stdin
 };
 
 struct ServerData {
 	std::vector<std::pair<uint32_t, uint16_t>>	listen_group; // <ip_address, port> pairs
+	std::vector<std::pair<uint32_t, uint16_t>>	default_server_for; // listen pairs marked default_server
 	std::vector<std::string>					server_names;
 	std::vector<Location>						locations;
+	LocationRouter								router; // compiled from locations after parsing
+};
+
+// The servers sharing one listening socket, looked up by Host
+struct ListenerData {
+	ServerData*		default_server = nullptr; // marked default_server, else the first one
+	bool			explicit_default = false;
+	std::unordered_map<std::string, ServerData*, StringHash, std::equal_to<>>	names; // lowercased
+	std::unordered_map<std::string, ServerData*, StringHash, std::equal_to<>>	wildcard_names; // "*.example.com" as ".example.com"
 };
 
 struct ClientData {
-	Request		request;
-	Response	response;
-	size_t		bytes_sent_total = 0;
-	size_t		bytes_write_total = 0;
-	time_t		last_activity;
-	CgiData		cgi;
-	int			server_fd = 0;
-	ServerData*	server = nullptr;
+	Request					request;
+	Response				response; // being prepared for the current request
+	std::deque<Response>	responses; // ready to be sent, in request order
+	size_t					bytes_write_total = 0;
+	size_t					requests_served = 0;
+	bool					closing = false; // no more requests after the queued ones
+	uint32_t				epoll_events = EPOLLIN;
+	bool					write_blocked = false; // edge mode: the last write was short
+	bool					rearm = false; // edge mode: reading stopped before the socket was drained
+	int64_t					last_activity = 0; // ms, from the cached loop clock
+	int64_t					timer_tick = 0; // tick of its live TimerWheel entry, 0 for none
+	const Location*			last_location = nullptr; // of the last queued response
+	CgiData					cgi;
+	int						server_fd = 0;
+	ServerData*				server = nullptr;
+	sockaddr_storage		address = {}; // of the client, for the access log
+	int64_t					accepted_at = 0; // us, monotonic
+	ConnectionState			state = CONN_IDLE; // counted in WorkerMetrics::connections
 };
 
 class Webserv {
 private:
 	Webserv( void );
+	Webserv( const Webserv& master, size_t worker_id );
 	~Webserv( void );
+	friend struct std::default_delete<Webserv>;
 
 	static Webserv _instance;
 
-	bool											_keep_running;
+	std::atomic<bool>								_keep_running;
+	std::atomic<bool>								_reload_requested;
+	size_t											_worker_id;
+	size_t											_worker_threads;
+	std::vector<std::unique_ptr<Webserv>>			_workers; // only filled in the main instance
+	const Webserv*									_master; // the main instance, itself there
+	WorkerMetrics									_metrics;
 	int												_epoll_fd;
-	size_t											_event_array_size;
+	int												_wake_fd;
+	int												_inotify_fd;
+	size_t											_event_array_size; // events_per_wait
+	bool											_edge_triggered; // event_mode: edge, for client sockets
+	size_t											_accept_budget; // connections accepted per loop iteration
+	size_t											_accept_budget_left;
+	uint64_t										_listen_overflows_start; // ListenOverflows when started
+	size_t											_pipeline_depth;
 	std::vector<ServerData>							_servers;
 	std::unordered_map<int, ClientData>				_clients_map;
 	std::unordered_map<int, int>					_pipe_map;
-	std::unordered_map<int, std::list<ServerData*>>	_server_sockets_map;
+	std::unordered_map<int, ListenerData>			_server_sockets_map;
+	std::unordered_map<std::string, FastCgiPool>	_fastcgi_pools; // keyed by backend address
+	std::unordered_map<int, FastCgiConnection*>		_fastcgi_map;
 	size_t											_chunk_size;
-	int												_timeout_period;
+	size_t											_cgi_buffer_size;
+	int												_client_header_timeout; // seconds, the defaults of every location
+	int												_client_body_timeout;
+	int												_send_timeout;
+	int												_keepalive_timeout;
+	int												_cgi_timeout;
+	size_t											_keepalive_requests;
+	size_t											_cgi_prefork; // warm interpreters per worker
+	std::deque<CgiProcess>							_cgi_prefork_pool;
+	std::vector<pid_t>								_cgi_killed; // not reaped yet
+	int64_t											_now; // ms, monotonic, read once per loop iteration
+	TimerWheel										_timers;
+	std::vector<TimerWheel::Entry>					_timers_due;
+	std::shared_ptr<AccessLog>						_access_log; // shared by all workers, null when off
 
 	// Webserv.cpp
 	void _stopServer( void );
+	void _wakeUp( void );
 	void _mainLoop( void );
-	void _checkTimeouts( void );
-	void _getTargetServer(int client_fd, const std::string& host);
+	void _updateClock( void );
+	void _expireTimers( void );
+	void _handleTimeout( int client_fd );
+	void _scheduleTimeout( int client_fd, ClientData& client_data );
+	int64_t _clientTimeout( const ClientData& client_data, TimeoutType* type = nullptr ) const;
+	void _reapCgiProcesses( void );
+	void _getTargetServer(int client_fd, std::string_view host);
 
 	// WebservConfig.cpp
-	void _sortLocationByPath( void );
+	int _compileLocations( void );
 	void _printConfig( void ) const;
 	int _parseConfigFile( const std::string& config_path );
 	int _parseConfigLine( const std::string& line, ServerData& server, Location& location, ConfigData& config_data );
 	int _parseLoggingLevel( const std::string& line );
+	int _parseLogFile( const std::string& line );
+	int _parseAccessLog( const std::string& line );
+	int _parseWorkerThreads( const std::string& line );
+	int _parseKeepAlive( const std::string& line );
+	int _parseEventMode( const std::string& line );
+	int _parseEventsPerWait( const std::string& line );
+	int _parseAcceptBudget( const std::string& line );
+	int _parseTimeout( const std::string& line, Location* location );
+	void _applyTimeoutDefaults( void );
+	int _parseCgiPrefork( const std::string& line );
 	int _parseServerData( ServerData& server, ConfigData& config_data, const std::string& line );
 	int _parseLocationPathLine( const std::string& line, ServerData& server, Location& location, ConfigData& config_data );
 	int _parseLocation( Location& location, const std::string& line );
@@ -95,36 +201,89 @@ private:
 
 	// WebservCgi.cpp
 	int _executeCgi( int client_fd );
-	int _executeChild( int client_fd );
-	void _connectCgi( int client_fd, int fd_in, int fd_out);
+	int _spawnProcess( const std::vector<std::string>& args, const std::vector<std::string>& env_strings,
+					   CgiProcess& process );
+	int _takePreforkedCgi( const std::string& path, const std::vector<std::string>& env_strings,
+						   CgiProcess& process );
+	void _fillPreforkPool( void );
+	void _closePreforkPool( void );
+	int _connectCgi( int client_fd, int fd_in, int fd_out);
 	int _connectCgiOut( int client_fd, int fd_in, int fd_out );
-	int _endCgi( int fd_res[2], int fd_body[2], int client_fd );
 	void _createEnvs( const Request& req, std::vector<std::string>& env_strings );
 	void _closeCgiPipe( int pipe_fd, CgiData& cgi, const char* err_msg );
+	void _closeCgi( CgiData& cgi, const char* err_msg );
+
+	// WebservFastCgi.cpp
+	int _executeFastCgi( int client_fd );
+	FastCgiConnection* _getFastCgiConnection( FastCgiPool& pool );
+	FastCgiConnection* _openFastCgiConnection( FastCgiPool& pool );
+	static int _resolveFastCgiAddress( const std::string& address, sockaddr_storage& addr, socklen_t& addr_len );
+	void _beginFastCgiRequest( FastCgiConnection& conn, int client_fd );
+	void _startQueuedFastCgi( FastCgiConnection& conn );
+	void _sendFastCgiBody( int client_fd );
+	void _handleFastCgiEvent( FastCgiConnection& conn, uint32_t events );
+	int _sendFastCgi( FastCgiConnection& conn );
+	void _recvFastCgi( FastCgiConnection& conn );
+	void _handleFastCgiRecord( FastCgiConnection& conn, const FastCgiRecord& record );
+	void _releaseFastCgiRequest( CgiData& cgi );
+	void _closeFastCgiConnection( FastCgiConnection& conn, const char* reason );
+	void _updateFastCgiEvents( FastCgiConnection& conn );
 
 	// WebservEvents.cpp
 	void _handleEvent( epoll_event& event );
+	void _handleCacheInvalidation( void );
 	void _handleConnection( const int server_fd );
+	void _addClient( int client_fd, int server_fd, const sockaddr_storage& address );
+	void _checkAcceptQueue( int server_fd );
+	void _handleClientEvent( int client_fd, uint32_t events );
 	void _handleClientRequest( int client_fd );
+	int _recvClientData( int client_fd );
+	void _processClientRequests( int client_fd );
 	int _getClientRequest( int client_fd );
+	void _queueResponse( int client_fd );
+	void _pushResponse( ClientData& client_data );
+	void _finishRequest( ClientData& client_data );
 	void _sendClientResponse( int client_fd );
+	void _waitForCgiOutput( int client_fd );
 	void _getCgiResponse( int fd_in );
+	void _receiveCgiOutput( int client_fd, std::string_view data, bool eof );
+	void _startCgiResponse( int client_fd, bool eof );
+	void _spliceCgiResponse( int client_fd );
+	void _finishCgiResponse( int client_fd );
+	void _abortCgi( int client_fd, const char* err_msg, size_t status_code = 500 );
 	void _sendCgiRequest( int fd_out );
+	void _streamCgiBody( int client_fd );
 	int _getTargetLocation( int client_fd );
 	int _checkRequestValid( const Request& request, int client_fd );
-	void _handleCgiResponse( ClientData& client_data );
+	int _checkBodySize( const Request& request, int client_fd );
+	void _checkKeepAlive( ClientData& client_data );
+	void _finishResponse( int client_fd );
+	void _logAccess( ClientData& client_data, Response& response, bool complete );
+	void _markCgiExit( Response& response );
+	void _prepareMetrics( Response& response ) const;
 
 	// WebservInit.cpp
+	int _initWorkers( void );
 	int _initWebserv( void );
 	int _initServer( ServerData& server, std::unordered_map<std::string, int>& listen_map);
+	int _addVirtualHost( ListenerData& listener, ServerData& server, bool default_server );
 	int _createServerSocket( uint32_t ip_address, uint16_t port );
 	int _addServerToEpoll( const int server_fd );
+	int _initCaches( void );
+	void _loadErrorPages( void );
 	int _initError( const char* err_msg, int fd );
 
 	// WebservUtils.cpp
 	int _setNonBlocking( int fd );
 	void _closeClientFd( int client_fd, const char* err_msg );
-	void _modifyEpollSocketOut( int client_fd );
+	void _updateClientEvents( int client_fd );
+	void _updateCgiEvents( ClientData& client_data );
+	size_t _pendingCgiOutput( const ClientData& client_data ) const;
+	void _setPipeEvents( int fd, uint32_t& current, uint32_t wanted );
+	void _logCacheStats( void ) const;
+	void _logCgiStats( void ) const;
+	void _logAcceptStats( void ) const;
+	static uint64_t _readListenOverflows( void );
 
 public:
 	Webserv( const Webserv& ) = delete;
@@ -134,6 +293,7 @@ public:
 
 	static Webserv& getInstance( void );
 	static void handleSigInt(int signum);
+	static void handleSigHup(int signum);
 
 	int startServer( const std::string& config_file );
 };
\ No newline at end of file
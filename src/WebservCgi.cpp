@@ -1,69 +1,166 @@
 #include "Webserv.hpp"
 
-int Webserv::_endCgi( int fd_res[2], int fd_body[2], int client_fd ) {
-	if (fd_res[0]) {
-		close(fd_res[0]);
-	}
-	if (fd_res[1]) {
-		close(fd_res[1]);
-	}
-	if (fd_body[0]) {
-		close(fd_body[0]);
-	}
-	if (fd_body[1]) {
-		close(fd_body[1]);
-	}
-	_clients_map[client_fd].response.prepareResponseError(500);
-	return 1;
+// Runs in a parked interpreter: reads "<length>\n" and the script path and
+// environment separated by NUL bytes from stdin, then runs the script in
+// place. Whatever follows on stdin is the request body.
+static const char* cgi_bootstrap = R"(
+import os, sys, runpy
+def read(n):
+	data = b""
+	while len(data) < n:
+		part = os.read(0, n - len(data))
+		if not part:
+			sys.exit(1)
+		data += part
+	return data
+length = b""
+while not length.endswith(b"\n"):
+	length += read(1)
+items = [item.decode("utf-8", "surrogateescape") for item in read(int(length)).split(b"\0")]
+os.environ.clear()
+os.environ.update(item.partition("=")[::2] for item in items[1:])
+sys.argv = [items[0]]
+sys.path[0] = os.path.dirname(items[0])
+runpy.run_path(items[0], run_name="__main__")
+)";
+
+static std::string cgiInterpreter( const std::string& path ) {
+	return path.substr(path.rfind('.') + 1) == "py" ? "/usr/bin/python3" : "/usr/bin/php";
 }
 
-int Webserv::_executeChild( int client_fd ) {
-	std::string path = _clients_map[client_fd].response.local_path;
-	std::string extension = path.substr(path.rfind('.') + 1);
-	std::string interpreter = (extension == "py" ? "python3" : "php");
-	std::string executor = "/usr/bin/" + interpreter;
-	std::vector<char*> cmds = {
-		const_cast<char*>(interpreter.c_str()),
-		const_cast<char*>(path.c_str()),
-		nullptr
-	};
+// The launch time, from here until the pipes are in epoll, goes to the
+// spawn latency histogram
+int Webserv::_executeCgi( int client_fd ) {
+	ClientData& client_data = _clients_map[client_fd];
+	if (!client_data.response.location->fastcgi_pass.empty()) {
+		return _executeFastCgi(client_fd);
+	}
+	auto start = std::chrono::steady_clock::now();
+	const std::string& path = client_data.response.local_path;
 	std::vector<std::string> env_strings;
-	_createEnvs(_clients_map[client_fd].request, env_strings);
-	std::vector<char*> envp;
-	for (std::string& env : env_strings) {
-		envp.push_back(const_cast<char*>(env.c_str()));
+	_createEnvs(client_data.request, env_strings);
+	CgiProcess process;
+	if (_takePreforkedCgi(path, env_strings, process) == 0) {
+		_metrics.cgi_preforked.add();
+	} else if (_spawnProcess({cgiInterpreter(path), path}, env_strings, process) == 0) {
+		_metrics.cgi_spawned.add();
+	} else {
+		logger.warning("Failed to launch CGI ", path);
+		client_data.response.prepareResponseError(500);
+		return 1;
 	}
-	envp.push_back(nullptr);
-	execve(executor.c_str(), cmds.data(), envp.data());
-	exit(EXIT_FAILURE);
+	client_data.cgi.pid = process.pid;
+	client_data.response.access_record.cgi_spawn = AccessLog::now();
+	int ret = _connectCgi(client_fd, process.fd_in, process.fd_out);
+	_metrics.cgi_spawn_time.record(std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - start).count());
+	return ret;
 }
 
-int Webserv::_executeCgi( int client_fd ) {
+// posix_spawn() does not copy the server's address space like fork() does.
+// Every descriptor of the server is opened close-on-exec (listeners, epoll,
+// clients, files, pipes), so the child keeps only its stdin and stdout and
+// a parked interpreter cannot hold a port after the server exits.
+int Webserv::_spawnProcess( const std::vector<std::string>& args,
+							const std::vector<std::string>& env_strings, CgiProcess& process ) {
 	int fd_res[2], fd_body[2];
-	if (pipe(fd_res) == -1 || pipe(fd_body) == -1) {
-		logger.warning("Pipe failed.");
-		return _endCgi(fd_res, fd_body, client_fd);
-	}
-	pid_t pid = fork();
-	if (pid == -1) {
-		logger.warning("Fork failed.");
-		return _endCgi(fd_res, fd_body, client_fd);
-	} else if (pid == 0) {
+	if (pipe2(fd_res, O_CLOEXEC) == -1) {
+		return 1;
+	}
+	if (pipe2(fd_body, O_CLOEXEC) == -1) {
 		close(fd_res[0]);
-		close(fd_body[1]);
-		dup2(fd_body[0], STDIN_FILENO);
-		dup2(fd_res[1], STDOUT_FILENO);
 		close(fd_res[1]);
-		close(fd_body[0]);
-		_executeChild(client_fd);
+		return 1;
 	}
-	_clients_map[client_fd].cgi.pid = pid;
+	std::vector<char*> argv;
+	for (const std::string& arg : args) {
+		argv.push_back(const_cast<char*>(arg.c_str()));
+	}
+	argv.push_back(nullptr);
+	std::vector<char*> envp;
+	for (const std::string& env : env_strings) {
+		envp.push_back(const_cast<char*>(env.c_str()));
+	}
+	envp.push_back(nullptr);
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, fd_body[0], STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, fd_res[1], STDOUT_FILENO);
+	int ret = posix_spawn(&process.pid, argv[0], &actions, nullptr, argv.data(), envp.data());
+	posix_spawn_file_actions_destroy(&actions);
 	close(fd_body[0]);
 	close(fd_res[1]);
-	_connectCgi(client_fd, fd_res[0], fd_body[1]);
+	if (ret != 0) {
+		close(fd_res[0]);
+		close(fd_body[1]);
+		return 1;
+	}
+	process.fd_in = fd_res[0];
+	process.fd_out = fd_body[1];
 	return 0;
 }
 
+// Python scripts can go to an interpreter that already started up
+int Webserv::_takePreforkedCgi( const std::string& path, const std::vector<std::string>& env_strings,
+								CgiProcess& process ) {
+	if (_cgi_prefork == 0 || cgiInterpreter(path) != "/usr/bin/python3") {
+		return 1;
+	}
+	std::string message = path;
+	for (const std::string& env : env_strings) {
+		message += '\0' + env;
+	}
+	message.insert(0, std::to_string(message.size()) + "\n");
+	if (_cgi_prefork_pool.empty()) {
+		return 1;
+	}
+	// the parked interpreter's pipe is empty, a message up to its capacity
+	// goes in with one write; a larger one is left to a spawned process
+	int capacity = fcntl(_cgi_prefork_pool.front().fd_out, F_GETPIPE_SZ);
+	if (capacity == -1 || message.size() > static_cast<size_t>(capacity)) {
+		return 1;
+	}
+	while (!_cgi_prefork_pool.empty()) {
+		process = _cgi_prefork_pool.front();
+		_cgi_prefork_pool.pop_front();
+		ssize_t bytes = write(process.fd_out, message.data(), message.size());
+		if (bytes == static_cast<ssize_t>(message.size())) {
+			return 0;
+		}
+		// a short write leaves it waiting for the rest, it cannot be reused
+		kill(process.pid, SIGKILL);
+		_cgi_killed.push_back(process.pid);
+		close(process.fd_in);
+		close(process.fd_out);
+		// only one that died while parked is replaced by the next
+		if (bytes != -1 || errno != EPIPE) {
+			return 1;
+		}
+	}
+	return 1;
+}
+
+void Webserv::_fillPreforkPool( void ) {
+	while (_cgi_prefork_pool.size() < _cgi_prefork) {
+		CgiProcess process;
+		if (_spawnProcess({"/usr/bin/python3", "-c", cgi_bootstrap}, {}, process) != 0) {
+			logger.warning("Failed to prefork a CGI interpreter");
+			return;
+		}
+		_setNonBlocking(process.fd_out);
+		_cgi_prefork_pool.push_back(process);
+	}
+}
+
+void Webserv::_closePreforkPool( void ) {
+	for (const CgiProcess& process : _cgi_prefork_pool) {
+		kill(process.pid, SIGKILL);
+		close(process.fd_in);
+		close(process.fd_out);
+	}
+	_cgi_prefork_pool.clear();
+}
+
 int Webserv::_connectCgiOut( int client_fd, int fd_in, int fd_out ) {
 	ClientData& client_data = _clients_map[client_fd];
 	CgiData& cgi = client_data.cgi;
@@ -74,7 +171,6 @@ int Webserv::_connectCgiOut( int client_fd, int fd_in, int fd_out ) {
 		event.data.fd = fd_out;
 		if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd_out, &event) == -1) {
 			client_data.response.prepareResponseError(500);
-			_modifyEpollSocketOut(client_fd);
 			close(fd_in);
 			_closeCgiPipe(fd_out, cgi, "Failed to add cgi.fd_out to epoll: ");
 			return 1;
@@ -87,43 +183,48 @@ int Webserv::_connectCgiOut( int client_fd, int fd_in, int fd_out ) {
 	return 0;
 }
 
-void Webserv::_connectCgi( int client_fd, int fd_in, int fd_out ) {
+// Returns 1 when the CGI could not be connected and the 500 response is ready
+int Webserv::_connectCgi( int client_fd, int fd_in, int fd_out ) {
 	ClientData& client_data = _clients_map[client_fd];
 	CgiData& cgi = client_data.cgi;
 	cgi.client_fd = client_fd;
 	_setNonBlocking(fd_out);
 	_setNonBlocking(fd_in);
 	if (_connectCgiOut(client_fd, fd_in, fd_out) == 1) {
-		return;
+		return 1;
 	}
 	epoll_event event;
-	event.events = EPOLLIN | EPOLLHUP;
+	event.events = EPOLLIN;
 	event.data.fd = fd_in;
 	if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd_in, &event) == -1) {
 		client_data.response.prepareResponseError(500);
-		_modifyEpollSocketOut(client_fd);
-		return _closeCgiPipe(fd_in, cgi, "Failed to add cgi.fd_in to epoll: ");
+		_closeCgiPipe(fd_in, cgi, "Failed to add cgi.fd_in to epoll: ");
+		return 1;
 	}
 	_pipe_map[fd_in] = client_fd;
 	cgi.fd_in = fd_in;
+	return 0;
 }
 
 // https://datatracker.ietf.org/doc/html/rfc3875#autoid-16
 void Webserv::_createEnvs( const Request& req, std::vector<std::string>& env_strings ) {
-	map_str_str env_map(req.headers);
-	env_map["PATH_INFO"] = req.path;
+	map_str_str env_map;
+	for (const auto& [name, value] : req.getHeaders()) {
+		env_map[std::string(name)] = value;
+	}
+	// a chunked body reaches the script decoded, with its final length
+	env_map.erase("Transfer-Encoding");
+	env_map.erase("Content-Length");
+	if (req.content_length > 0) {
+		env_map["CONTENT_LENGTH"] = std::to_string(req.content_length);
+	}
+	env_map["PATH_INFO"] = req.getPath();
 	env_map["SERVER_PROTOCOL"] = "HTTP/1.1";
 	env_map["GATEWAY_INTERFACE"] = "CGI/1.1";
-	for (auto it = req.params.begin(); it != req.params.end(); ++it) {
-		env_map["QUERY_STRING"] += it->first;
-		env_map["QUERY_STRING"] += "=";
-		env_map["QUERY_STRING"] += it->second;
-		if (it != req.params.end()) {
-			env_map["QUERY_STRING"] += "&";
-		}
-	}
+	env_map["QUERY_STRING"] = req.getQuery();
 	std::unordered_map<Method, std::string> methods_map = {
 		{GET, "GET"},
+		{HEAD, "HEAD"},
 		{POST, "POST"},
 		{DELETE, "DELETE"}
 	};
@@ -149,7 +250,7 @@ void Webserv::_closeCgiPipe( int pipe_fd, CgiData& cgi, const char* err_msg ) {
 	if (err_msg != nullptr) {
 		perror(err_msg);
 	}
-	logger.debug("Pipe was closed. Pipe: " + std::to_string(pipe_fd));
+	logger.debug("Pipe was closed. Pipe: ", pipe_fd);
 	if (pipe_fd == cgi.fd_out) {
 		cgi.fd_out = 0;
 	} else {
@@ -158,6 +259,20 @@ void Webserv::_closeCgiPipe( int pipe_fd, CgiData& cgi, const char* err_msg ) {
 			_closeCgiPipe(cgi.fd_out, cgi, nullptr);
 		}
 		kill(cgi.pid, SIGKILL);
-		cgi.pid = 0;
+		_cgi_killed.push_back(cgi.pid);
+		cgi = CgiData();
+	}
+}
+
+// Stops whatever produces the response of the current request. Used
+// interpreters are replaced only now, so starting one does not compete
+// with the script it was taken for.
+void Webserv::_closeCgi( CgiData& cgi, const char* err_msg ) {
+	if (cgi.fastcgi != nullptr) {
+		_releaseFastCgiRequest(cgi);
+	} else if (cgi.pid != 0) {
+		_closeCgiPipe(cgi.fd_in, cgi, err_msg);
+		_fillPreforkPool();
 	}
+	cgi = CgiData();
 }
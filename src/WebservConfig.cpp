@@ -1,36 +1,62 @@
 #include "Webserv.hpp"
 
-void Webserv::_sortLocationByPath( void ) {
+int Webserv::_compileLocations( void ) {
 	for (ServerData& server : _servers) {
-		std::vector<Location>& locations = server.locations;
-		std::sort(locations.begin(), locations.end(),
-				[](const Location& a, const Location& b) {
-					return a.path.size() > b.path.size();
-				});
+		for (size_t i = 0; i < server.locations.size(); ++i) {
+			const Location& location = server.locations[i];
+			if (server.router.add(location.path, location.exact, static_cast<int>(i)) != 0) {
+				logger.error("Duplicate location: ", location.path);
+				return 1;
+			}
+		}
+		server.router.compile();
 	}
+	return 0;
 }
 
 void Webserv::_printConfig( void ) const {
 	std::cout << "\033[36m" << "_______\nCONFIG" << std::endl;
+	std::cout << "Worker threads: " << _worker_threads << std::endl;
+	std::cout << "Events: " << (_edge_triggered ? "edge" : "level") << ", "
+			  << _event_array_size << " per wait, accept budget " << _accept_budget << std::endl;
+	std::cout << "Keepalive: " << _keepalive_timeout << "s, " << _keepalive_requests << " requests" << std::endl;
+	std::cout << "Timeouts: header " << _client_header_timeout << "s, body " << _client_body_timeout
+			  << "s, send " << _send_timeout << "s, cgi " << _cgi_timeout << "s" << std::endl;
+	std::cout << "CGI prefork: " << _cgi_prefork << std::endl;
 	for (const ServerData& server : _servers) {
-		for (const auto& [ip_address, port] : server.listen_group) {
-			std::cout << "\nListen at: " << ip_address << ":" << port << std::endl;
+		for (const auto& listen : server.listen_group) {
+			const auto& defaults = server.default_server_for;
+			bool default_server = std::find(defaults.begin(), defaults.end(), listen) != defaults.end();
+			std::cout << "\nListen at: " << listen.first << ":" << listen.second
+					  << (default_server ? " default_server" : "") << std::endl;
 		}
 		for (const std::string& server_name : server.server_names) {
 			std::cout << "Server Name: " <<  server_name << std::endl;
 		}
 		for (const Location& location : server.locations) {
-			std::cout << "Location:\n\tpath: " << location.path << std::endl;
+			std::cout << "Location:\n\tpath: " << (location.exact ? "= " : "") << location.path << std::endl;
 			std::cout << "\troot: " << location.root << std::endl;
 			std::cout << "\tindex: " << location.index_page << std::endl;
 			std::cout << "\tredirect_path: " << location.redirect_code << " " << location.redirect_path << std::endl;
 			std::cout << "\tautoindex: " << location.autoindex << std::endl;
 			std::cout << "\tclient_max_body_size: " << location.client_max_body_size << std::endl;
+			std::cout << "\topen_cache_size: " << location.open_cache_size << std::endl;
+			std::cout << "\tetag: " << location.etag << std::endl;
+			std::cout << "\tgzip: " << location.gzip << " (cache " << location.gzip_cache_size
+					  << "), gzip_static: " << location.gzip_static << std::endl;
+			std::cout << "\tstub_status: " << location.stub_status << std::endl;
+			std::cout << "\ttimeouts: body " << location.client_body_timeout << "s, send " << location.send_timeout
+					  << "s, keepalive " << location.keepalive_timeout << "s, cgi " << location.cgi_timeout << "s" << std::endl;
+			if (!location.fastcgi_pass.empty()) {
+				std::cout << "\tfastcgi_pass: " << location.fastcgi_pass
+						  << " (" << location.fastcgi_connections << " connections)" << std::endl;
+			}
 			for (const auto& [error_code, error_page] : location.error_pages) {
 				std::cout << "\terror_page: " << error_code << " " << error_page << std::endl;
 			}
 			std::unordered_map<Method, std::string> methods_map = {
 				{GET, "GET"},
+				{HEAD, "HEAD"},
 				{POST, "POST"},
 				{DELETE, "DELETE"}
 			};
@@ -91,11 +117,14 @@ int Webserv::_parseListenGroup( ServerData& server, std::istringstream& line_str
 			ip = _ipStringToDecimal(ip_address);
 		}
 		server.listen_group.push_back(std::make_pair(ip, port));
+		if (line.find("default_server") != std::string::npos) {
+			server.default_server_for.push_back(std::make_pair(ip, port));
+		}
 	} catch (const std::invalid_argument& e) {
-		logger.error("Invalid ip:port format: " + std::string(e.what()));
+		logger.error("Invalid ip:port format: ", e.what());
 		return 1;
 	} catch (const std::out_of_range& e) {
-		logger.error("[ip:port] out of range: " + std::string(e.what()));
+		logger.error("[ip:port] out of range: ", e.what());
 		return 1;
 	}
 	return 0;
@@ -106,7 +135,7 @@ int Webserv::_parseErrorPage( std::istringstream& line_stream, std::unordered_ma
 	std::string error_path;
 	while (line_stream >> error_code) {
 		if (error_code < 400 || error_code > 599) {
-			logger.error("Invalid error code: " + std::to_string(error_code));
+			logger.error("Invalid error code: ", error_code);
 			return 1;
 		}
 		error_pages[error_code] = "";
@@ -124,7 +153,7 @@ int Webserv::_parseErrorPage( std::istringstream& line_stream, std::unordered_ma
 int Webserv::_parseServerData( ServerData& server, ConfigData& config_data, const std::string& line ) {
 	size_t delimiter = line.find(":");
 	if (delimiter == std::string::npos) {
-		logger.error("Invalid server line: " + line);
+		logger.error("Invalid server line: ", line);
 		return 1;
 	}
 	std::istringstream line_stream(line.substr(delimiter + 1));
@@ -145,7 +174,7 @@ int Webserv::_parseServerData( ServerData& server, ConfigData& config_data, cons
 	} else if (line.find("error_page:") != std::string::npos) {
 		if (_parseErrorPage(line_stream, config_data.error_pages) == 1) return 1;
 	} else {
-		logger.error("Invalid config line: " + line);
+		logger.error("Invalid config line: ", line);
 		return 1;
 	}
 	return 0;
@@ -156,6 +185,7 @@ int Webserv::_parseAllowedMethod( std::istringstream& line_stream, std::set<Meth
 	std::string method;
 	std::unordered_map<std::string, Method> methods_map = {
 		{"GET", GET},
+		{"HEAD", HEAD},
 		{"POST", POST},
 		{"DELETE", DELETE}
 	};
@@ -163,8 +193,12 @@ int Webserv::_parseAllowedMethod( std::istringstream& line_stream, std::set<Meth
 		auto it = methods_map.find(method);
 		if (it != methods_map.end()) {
 			allowed_methods.insert(it->second);
+			// a location that serves GET also answers HEAD
+			if (it->second == GET) {
+				allowed_methods.insert(HEAD);
+			}
 		} else {
-			logger.warning("Invalid method: " + method);
+			logger.warning("Invalid method: ", method);
 			return 1;
 		}
 	}
@@ -174,12 +208,52 @@ int Webserv::_parseAllowedMethod( std::istringstream& line_stream, std::set<Meth
 int Webserv::_parseLocation( Location& location, const std::string& line ) {
 	size_t delimiter = line.find(":");
 	if (delimiter == std::string::npos) {
-		logger.error("Invalid location line: " + line);
+		logger.error("Invalid location line: ", line);
 		return 1;
 	}
 	std::istringstream line_stream(line.substr(delimiter + 1));
 
-	if (line.find("root:") != std::string::npos) {
+	if (line.find("open_cache_size:") != std::string::npos) {
+		line_stream >> location.open_cache_size;
+	} else if (line.find("gzip_static:") != std::string::npos) {
+		location.gzip_static = line.find("on") != std::string::npos;
+	} else if (line.find("stub_status:") != std::string::npos) {
+		location.stub_status = line.find("on") != std::string::npos;
+	} else if (line.find("gzip:") != std::string::npos) {
+		std::string mode;
+		line_stream >> mode;
+		location.gzip = mode == "on";
+		if (line_stream >> location.gzip_cache_size && location.gzip_cache_size == 0) {
+			logger.error("Invalid gzip cache size: ", line);
+			return 1;
+		}
+	} else if (line.find("etag:") != std::string::npos) {
+		std::string mode;
+		line_stream >> mode;
+		std::unordered_map<std::string, EtagMode> modes_map = {
+			{"strong", ETAG_STRONG},
+			{"weak", ETAG_WEAK},
+			{"off", ETAG_OFF}
+		};
+		auto it = modes_map.find(mode);
+		if (it == modes_map.end()) {
+			logger.error("Invalid etag: ", line);
+			return 1;
+		}
+		location.etag = it->second;
+	} else if (line.find("fastcgi_pass:") != std::string::npos) {
+		sockaddr_storage addr;
+		socklen_t addr_len;
+		line_stream >> location.fastcgi_pass;
+		if (!(line_stream >> location.fastcgi_connections)) {
+			location.fastcgi_connections = 4;
+		}
+		if (_resolveFastCgiAddress(location.fastcgi_pass, addr, addr_len) != 0
+			|| location.fastcgi_connections == 0) {
+			logger.error("Invalid fastcgi_pass: ", line);
+			return 1;
+		}
+	} else if (line.find("root:") != std::string::npos) {
 		line_stream >> location.root;
 	} else if (line.find("autoindex:") != std::string::npos) {
 		if (line.find("on") != std::string::npos) {
@@ -197,8 +271,10 @@ int Webserv::_parseLocation( Location& location, const std::string& line ) {
 		line_stream >> location.redirect_code >> location.redirect_path;
 	} else if (line.find("limit_except:") != std::string::npos) {
 		if (_parseAllowedMethod(line_stream, location.allowed_methods) == 1) return 1;
+	} else if (line.find("_timeout:") != std::string::npos) {
+		if (_parseTimeout(line, &location) == 1) return 1;
 	} else {
-		logger.error("Invalid config line: " + line);
+		logger.error("Invalid config line: ", line);
 		return 1;
 	}
 	return 0;
@@ -207,7 +283,7 @@ int Webserv::_parseLocation( Location& location, const std::string& line ) {
 int Webserv::_parseLoggingLevel( const std::string& line ) {
 	size_t delimiter = line.find(":");
 	if (delimiter == std::string::npos) {
-		logger.error("Invalid line: " + line);
+		logger.error("Invalid line: ", line);
 		return 1;
 	}
 	std::istringstream line_stream(line.substr(delimiter + 1));
@@ -227,12 +303,161 @@ int Webserv::_parseLoggingLevel( const std::string& line ) {
 	if (it != levels_map.end()) {
 		logger.setLevel(it->second);
 	} else {
-		logger.error("Invalid Level: " + line);
+		logger.error("Invalid Level: ", line);
+		return 1;
+	}
+	return 0;
+}
+
+int Webserv::_parseLogFile( const std::string& line ) {
+	std::istringstream line_stream(line.substr(line.find(":") + 1));
+	std::string path;
+	line_stream >> path;
+	if (path.empty() || logger.setFile(path) != 0) {
+		logger.error("Invalid log_file: ", line);
 		return 1;
 	}
 	return 0;
 }
 
+// "access_log: <path> [text|json]", text by default
+int Webserv::_parseAccessLog( const std::string& line ) {
+	std::istringstream line_stream(line.substr(line.find(":") + 1));
+	std::string path;
+	std::string format;
+	line_stream >> path >> format;
+	AccessLogFormat access_format = format == "json" ? ACCESS_LOG_JSON : ACCESS_LOG_TEXT;
+	if (path == "off") {
+		_access_log.reset();
+		return 0;
+	}
+	_access_log = std::make_shared<AccessLog>();
+	if (path.empty() || (!format.empty() && format != "text" && format != "json")
+		|| _access_log->open(path, access_format) != 0) {
+		logger.error("Invalid access_log: ", line);
+		return 1;
+	}
+	return 0;
+}
+
+int Webserv::_parseWorkerThreads( const std::string& line ) {
+	std::istringstream line_stream(line.substr(line.find(":") + 1));
+	std::string value;
+	line_stream >> value;
+	if (value == "auto") {
+		_worker_threads = std::max(1u, std::thread::hardware_concurrency());
+		return 0;
+	}
+	try {
+		long threads = std::stol(value);
+		if (threads < 1 || threads > 1024) {
+			throw std::out_of_range(value);
+		}
+		_worker_threads = static_cast<size_t>(threads);
+	} catch (const std::exception& e) {
+		logger.error("Invalid worker_threads: ", line);
+		return 1;
+	}
+	return 0;
+}
+
+int Webserv::_parseKeepAlive( const std::string& line ) {
+	std::istringstream line_stream(line.substr(line.find(":") + 1));
+	long value;
+	if (!(line_stream >> value) || value < 0 || value > INT32_MAX) {
+		logger.error("Invalid keepalive value: ", line);
+		return 1;
+	}
+	_keepalive_requests = static_cast<size_t>(value);
+	return 0;
+}
+
+int Webserv::_parseEventMode( const std::string& line ) {
+	std::istringstream line_stream(line.substr(line.find(":") + 1));
+	std::string mode;
+	line_stream >> mode;
+	if (mode != "level" && mode != "edge") {
+		logger.error("Invalid event_mode: ", line);
+		return 1;
+	}
+	_edge_triggered = mode == "edge";
+	return 0;
+}
+
+int Webserv::_parseEventsPerWait( const std::string& line ) {
+	std::istringstream line_stream(line.substr(line.find(":") + 1));
+	long value;
+	if (!(line_stream >> value) || value < 1 || value > 65536) {
+		logger.error("Invalid events_per_wait: ", line);
+		return 1;
+	}
+	_event_array_size = static_cast<size_t>(value);
+	return 0;
+}
+
+int Webserv::_parseAcceptBudget( const std::string& line ) {
+	std::istringstream line_stream(line.substr(line.find(":") + 1));
+	long value;
+	if (!(line_stream >> value) || value < 1 || value > 65536) {
+		logger.error("Invalid accept_budget: ", line);
+		return 1;
+	}
+	_accept_budget = static_cast<size_t>(value);
+	return 0;
+}
+
+// At the top level the value is the default of every location, in a
+// location it overrides it. The header timeout runs before a location is
+// known, so it is global only. keepalive_timeout 0 disables keep-alive.
+int Webserv::_parseTimeout( const std::string& line, Location* location ) {
+	std::istringstream line_stream(line.substr(line.find(":") + 1));
+	long value;
+	bool keepalive = line.find("keepalive_timeout:") != std::string::npos;
+	if (!(line_stream >> value) || value < (keepalive ? 0 : 1) || value > INT32_MAX / 1000) {
+		logger.error("Invalid timeout: ", line);
+		return 1;
+	}
+	std::unordered_map<std::string, std::pair<int*, int*>> timeouts = {
+		{"client_header_timeout:", {&_client_header_timeout, nullptr}},
+		{"client_body_timeout:", {&_client_body_timeout, location ? &location->client_body_timeout : nullptr}},
+		{"send_timeout:", {&_send_timeout, location ? &location->send_timeout : nullptr}},
+		{"keepalive_timeout:", {&_keepalive_timeout, location ? &location->keepalive_timeout : nullptr}},
+		{"cgi_timeout:", {&_cgi_timeout, location ? &location->cgi_timeout : nullptr}}
+	};
+	for (const auto& [name, targets] : timeouts) {
+		if (line.find(name) == std::string::npos) continue;
+		int* target = location ? targets.second : targets.first;
+		if (target == nullptr) break;
+		*target = static_cast<int>(value);
+		return 0;
+	}
+	logger.error("Invalid config line: ", line);
+	return 1;
+}
+
+// Top level timeouts may follow the servers, so they are applied last
+void Webserv::_applyTimeoutDefaults( void ) {
+	for (ServerData& server : _servers) {
+		for (Location& location : server.locations) {
+			if (location.client_body_timeout == -1) location.client_body_timeout = _client_body_timeout;
+			if (location.send_timeout == -1) location.send_timeout = _send_timeout;
+			if (location.keepalive_timeout == -1) location.keepalive_timeout = _keepalive_timeout;
+			if (location.cgi_timeout == -1) location.cgi_timeout = _cgi_timeout;
+		}
+	}
+}
+
+int Webserv::_parseCgiPrefork( const std::string& line ) {
+	std::istringstream line_stream(line.substr(line.find(":") + 1));
+	long value;
+	if (!(line_stream >> value) || value < 0 || value > 1024) {
+		logger.error("Invalid cgi_prefork: ", line);
+		return 1;
+	}
+	_cgi_prefork = static_cast<size_t>(value);
+	return 0;
+}
+
 void Webserv::_checkParamsPriority( ServerData& server, ConfigData& config_data ) {
 	for (Location& location : server.locations) {
 		if (location.autoindex == -1) {
@@ -258,7 +483,7 @@ int Webserv::_parseConfigLine( const std::string& line, ServerData& server, Loca
 		if (config_data.server_indentation == 0) {
 			config_data.server_indentation = curr_indentation;
 		} else if (curr_indentation != config_data.server_indentation) {
-			logger.error("Unclear indentation: " + line);
+			logger.error("Unclear indentation: ", line);
 			return 1;
 		}
 		if (_parseServerData(server, config_data, line)) return 1;
@@ -275,7 +500,7 @@ int Webserv::_parseConfigLine( const std::string& line, ServerData& server, Loca
 			config_data.status = SERVER;
 			if (_parseServerData(server, config_data, line)) return 1;
 		} else {
-			logger.error("Unclear indentation: " + line);
+			logger.error("Unclear indentation: ", line);
 			return 1;
 		}
 	}
@@ -307,10 +532,15 @@ int Webserv::_parseLocationPathLine( const std::string& line, ServerData& server
 	size_t delimiter1 = line.find('/');
 	size_t delimiter2 = line.find(':');
 	if (delimiter1 == std::string::npos || delimiter2 == std::string::npos) {
-		logger.warning("Invalid location line: " + line);
+		logger.warning("Invalid location line: ", line);
 		return 1;
 	}
 	location.path = line.substr(delimiter1, delimiter2 - delimiter1);
+	location.exact = line.find('=') < delimiter1;
+	// "/cgi/" routes like "/cgi", a path is matched by whole segments
+	while (location.path.size() > 1 && location.path.back() == '/') {
+		location.path.pop_back();
+	}
 	config_data.status = LOCATION;
 	return 0;
 }
@@ -335,6 +565,24 @@ int Webserv::_parseConfigFile( const std::string& config_path ) {
 		}
 		if (line.find("logging_level:") != std::string::npos) {
 			if (_parseLoggingLevel(line) == 1) return 1;
+		} else if (line.find("log_file:") != std::string::npos) {
+			if (_parseLogFile(line) == 1) return 1;
+		} else if (line.find("access_log:") != std::string::npos) {
+			if (_parseAccessLog(line) == 1) return 1;
+		} else if (line.find("worker_threads:") != std::string::npos) {
+			if (_parseWorkerThreads(line) == 1) return 1;
+		} else if (line.find("event_mode:") != std::string::npos) {
+			if (_parseEventMode(line) == 1) return 1;
+		} else if (line.find("events_per_wait:") != std::string::npos) {
+			if (_parseEventsPerWait(line) == 1) return 1;
+		} else if (line.find("accept_budget:") != std::string::npos) {
+			if (_parseAcceptBudget(line) == 1) return 1;
+		} else if (line.find("_timeout:") != std::string::npos && _getIndentation(line) == 0) {
+			if (_parseTimeout(line, nullptr) == 1) return 1;
+		} else if (line.find("keepalive_requests:") != std::string::npos) {
+			if (_parseKeepAlive(line) == 1) return 1;
+		} else if (line.find("cgi_prefork:") != std::string::npos) {
+			if (_parseCgiPrefork(line) == 1) return 1;
 		} else if (line.find("server:") != std::string::npos) {
 			if (config_data.status != START && _addServer(server, config_data, location)) return 1;
 			config_data.status = SERVER;
@@ -345,7 +593,8 @@ int Webserv::_parseConfigFile( const std::string& config_path ) {
 		}
 	}
 	if (_addServer(server, config_data, location)) return 1;
-	_sortLocationByPath();
+	_applyTimeoutDefaults();
+	if (_compileLocations() != 0) return 1;
 	if (logger.getLevel() == DEBUG) _printConfig();
 	return 0;
 }
\ No newline at end of file
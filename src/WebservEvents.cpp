@@ -1,89 +1,295 @@
 #include "Webserv.hpp"
 
 void Webserv::_handleEvent( epoll_event& event ) {
-	if (_server_sockets_map.find(event.data.fd) != _server_sockets_map.end()) {
+	if (event.data.fd == _wake_fd) {
+		uint64_t value;
+		ssize_t bytes = read(_wake_fd, &value, sizeof(value));
+		(void)bytes;
+	} else if (event.data.fd == _inotify_fd) {
+		_handleCacheInvalidation();
+	} else if (_server_sockets_map.find(event.data.fd) != _server_sockets_map.end()) {
 		_handleConnection(event.data.fd);
+	} else if (_fastcgi_map.find(event.data.fd) != _fastcgi_map.end()) {
+		_handleFastCgiEvent(*_fastcgi_map[event.data.fd], event.events);
 	} else if (_pipe_map.find(event.data.fd) != _pipe_map.end()) {
-		if (event.events & EPOLLOUT) {
+		int client_fd = _pipe_map[event.data.fd];
+		if (event.data.fd == _clients_map[client_fd].cgi.fd_out) {
 			_sendCgiRequest(event.data.fd);
-		} else if ((event.events & EPOLLIN) || (event.events & EPOLLHUP)) {
+		} else {
 			_getCgiResponse(event.data.fd);
 		}
 	} else if (_clients_map.find(event.data.fd) == _clients_map.end()) {
 		return;
-	} else if (event.events & EPOLLIN) {
-		_handleClientRequest(event.data.fd);
-	} else if (event.events & EPOLLOUT) {
-		_sendClientResponse(event.data.fd);
+	} else if (event.events & EPOLLERR) {
+		_closeClientFd(event.data.fd, nullptr);
+	} else if (event.events & (EPOLLIN | EPOLLOUT)) {
+		_handleClientEvent(event.data.fd, event.events);
+	} else if (event.events & EPOLLHUP) {
+		_closeClientFd(event.data.fd, nullptr);
 	}
 }
 
-void Webserv::_handleConnection( const int server_fd ) {
-	sockaddr_in client_addr;
-	socklen_t client_len = sizeof(client_addr);
-	int client_fd = accept(server_fd, (sockaddr*)&client_addr, &client_len);
-	if (client_fd == -1) {
-		perror("Failed to accept connection");
-		return;
-	} else {
-		_clients_map[client_fd].last_activity = time(nullptr);
-        _clients_map[client_fd].server_fd = server_fd;
+void Webserv::_handleCacheInvalidation( void ) {
+	alignas(inotify_event) char buffer[_chunk_size];
+	ssize_t bytes = read(_inotify_fd, buffer, sizeof(buffer));
+	for (ssize_t i = 0; i < bytes;) {
+		inotify_event* event = reinterpret_cast<inotify_event*>(buffer + i);
+		std::string name = event->len > 0 ? event->name : "";
+		logger.debug("Cache invalidation: ", name);
+		if (event->mask & IN_Q_OVERFLOW) {
+			logger.warning("Cache invalidation events were lost, response caches cleared");
+		} else if (event->mask & IN_MOVE_SELF) {
+			// the watch would follow the directory to its new name
+			inotify_rm_watch(_inotify_fd, event->wd);
+		}
+		for (ServerData& server : _servers) {
+			for (Location& location : server.locations) {
+				for (ResponseCache* cache : {location.cache.get(), location.gzip_cache.get()}) {
+					if (cache == nullptr) continue;
+					if (event->mask & IN_Q_OVERFLOW) {
+						cache->clear();
+					} else if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+						cache->invalidateWatch(event->wd);
+					} else {
+						cache->invalidate(event->wd, name);
+					}
+				}
+			}
+		}
+		i += sizeof(inotify_event) + event->len;
 	}
-	if (_setNonBlocking(client_fd) == -1) {
-		_closeClientFd(client_fd, "Failed to set non-blocking mode: client_fd");
-		return;
+}
+
+// Takes connections until the queue is empty or the budget of this loop
+// iteration is spent, the listener stays readable for the next one
+void Webserv::_handleConnection( const int server_fd ) {
+	while (_accept_budget_left > 0) {
+		sockaddr_storage address;
+		socklen_t address_len = sizeof(address);
+		int client_fd = accept4(server_fd, reinterpret_cast<sockaddr*>(&address), &address_len,
+								SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (client_fd == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				perror("Failed to accept connection");
+			}
+			return;
+		}
+		--_accept_budget_left;
+		// headers and sendfile() go out as separate writes, with Nagle the
+		// tail of the file would wait for the client's delayed ACK
+		int nodelay = 1;
+		setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+		_metrics.connections_accepted.add();
+		_addClient(client_fd, server_fd, address);
 	}
+	_metrics.accept_budget_exhausted.add();
+	_checkAcceptQueue(server_fd);
+}
+
+void Webserv::_addClient( int client_fd, int server_fd, const sockaddr_storage& address ) {
+	ClientData& client_data = _clients_map[client_fd];
+	client_data.last_activity = _now;
+	client_data.server_fd = server_fd;
+	client_data.address = address;
+	client_data.accepted_at = AccessLog::now();
+	_metrics.connections[CONN_IDLE].add();
+	_scheduleTimeout(client_fd, client_data);
 	epoll_event event;
-	event.events = EPOLLIN;
+	event.events = EPOLLIN | (_edge_triggered ? EPOLLET : 0u);
 	event.data.fd = client_fd;
 	if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, client_fd, &event) == -1) {
 		_closeClientFd(client_fd, "epoll_ctl: add client_fd");
 		return;
 	}
-	logger.debug("Accepted connection on client_fd " + std::to_string(client_fd));
+	logger.debug("Accepted connection on client_fd ", client_fd);
 }
 
-void Webserv::_handleClientRequest( int client_fd ) {
-	ClientData& client_data = _clients_map[client_fd];
-	if (_getClientRequest(client_fd) != 0) {
+// For a listener TCP_INFO reports the accept queue length in tcpi_unacked
+// and the backlog in tcpi_sacked. Only asked when the budget ran out.
+void Webserv::_checkAcceptQueue( int server_fd ) {
+	tcp_info info;
+	socklen_t info_len = sizeof(info);
+	if (getsockopt(server_fd, IPPROTO_TCP, TCP_INFO, &info, &info_len) == -1) {
 		return;
 	}
-	Response& response = client_data.response;
-	if (client_data.request.status == INVALID) {
-		response.prepareResponseError(400);
-	} else if (response.prepareResponse(client_data.request.path) == 0 
-			   && _executeCgi(client_fd) == 0) {
+	_metrics.accept_queue_peak.raise(info.tcpi_unacked);
+	if (info.tcpi_unacked >= info.tcpi_sacked) {
+		logger.warning("Accept queue full on listener ", server_fd, ": ", info.tcpi_unacked, " connections waiting");
+	}
+}
+
+// In edge mode nothing reports the same readiness twice: writing goes on
+// until the socket is full, and a response queued by the read is written
+// right away instead of after another epoll_wait
+void Webserv::_handleClientEvent( int client_fd, uint32_t events ) {
+	if (events & EPOLLIN) {
+		_handleClientRequest(client_fd);
+		if (!_edge_triggered) return;
+	}
+	auto it = _clients_map.find(client_fd);
+	if (it != _clients_map.end() && (events & EPOLLOUT)) {
+		it->second.write_blocked = false;
+	}
+	do {
+		if (it == _clients_map.end() || !(it->second.epoll_events & EPOLLOUT)
+			|| it->second.write_blocked) {
+			return;
+		}
+		_sendClientResponse(client_fd);
+		it = _clients_map.find(client_fd);
+	} while (_edge_triggered);
+}
+
+void Webserv::_handleClientRequest( int client_fd ) {
+	if (_recvClientData(client_fd) != 0) {
 		return;
 	}
-	logger.debug(client_data.response.full_response);
-	_modifyEpollSocketOut(client_fd);
+	if (_clients_map[client_fd].cgi.running()) {
+		return _streamCgiBody(client_fd);
+	}
+	_processClientRequests(client_fd);
 }
 
-int Webserv::_getClientRequest( int client_fd ) {
+// In edge mode the socket is read until a short read shows it is empty.
+// A failed read there means it was empty already, a broken connection is
+// reported as EPOLLERR. At most _cgi_buffer_size is taken per wakeup, what
+// is left is reported again after the rearm in _updateClientEvents.
+int Webserv::_recvClientData( int client_fd ) {
+	ClientData& client_data = _clients_map[client_fd];
 	char buffer[_chunk_size];
-	Request& request = _clients_map[client_fd].request;
-	ssize_t bytes = recv(client_fd, buffer, sizeof(buffer), 0);
-	logger.debug(std::to_string(bytes) + " bytes received from client_fd " + std::to_string(client_fd));
-	if (bytes <= 0) {
-		_closeClientFd(client_fd, "Recv failed");
+	size_t received = 0;
+	while (true) {
+		ssize_t bytes = recv(client_fd, buffer, sizeof(buffer), 0);
+		logger.debug(bytes, " bytes received from client_fd ", client_fd);
+		if (bytes == 0 || (bytes < 0 && !_edge_triggered)) {
+			_closeClientFd(client_fd, "Recv failed");
+			return 1;
+		} else if (bytes < 0) {
+			break;
+		}
+		client_data.request.raw.append(buffer, bytes);
+		received += bytes;
+		if (!_edge_triggered || static_cast<size_t>(bytes) < sizeof(buffer)) {
+			break;
+		} else if (received >= _cgi_buffer_size) {
+			client_data.rearm = true;
+			break;
+		}
+	}
+	if (received == 0) {
 		return 1;
-	} else if (bytes > 0) {
-		request.raw.append(buffer, bytes);
 	}
-	if (request.status == NEW && request.raw.find("\r\n\r\n") != std::string::npos) {
+	_metrics.bytes_received.add(received);
+	client_data.last_activity = _now;
+	return 0;
+}
+
+// Answers every complete request in the receive buffer. Stops at a CGI
+// request, since its response has to be queued before the next ones
+void Webserv::_processClientRequests( int client_fd ) {
+	ClientData& client_data = _clients_map[client_fd];
+	while (!client_data.closing && !client_data.cgi.running()
+		   && client_data.responses.size() < _pipeline_depth) {
+		int ret = _getClientRequest(client_fd);
+		if (ret == 2) {
+			break;
+		}
+		Request& request = client_data.request;
+		Response& response = client_data.response;
+		response.header_only = request.method == HEAD;
+		if (ret == 0 && (request.method == GET || request.method == HEAD)) {
+			response.range = request.getHeader("Range");
+			response.if_range = request.getHeader("If-Range");
+			response.if_none_match = request.getHeader("If-None-Match");
+			response.if_modified_since = request.getHeader("If-Modified-Since");
+			response.accept_encoding = request.getHeader("Accept-Encoding");
+		}
+		if (ret != 0) {
+			// already answered while validating the request
+		} else if (request.status == INVALID) {
+			response.prepareResponseError(400);
+		} else if (response.location->stub_status) {
+			_prepareMetrics(response);
+		} else if (response.prepareResponse(request.getPath()) == 0 
+				   && _executeCgi(client_fd) == 0) {
+			break;
+		}
+		logger.debug("Response of ", response.pendingSize(), " bytes for client_fd ", client_fd);
+		_queueResponse(client_fd);
+	}
+	_updateClientEvents(client_fd);
+}
+
+void Webserv::_queueResponse( int client_fd ) {
+	ClientData& client_data = _clients_map[client_fd];
+	_pushResponse(client_data);
+	_finishRequest(client_data);
+}
+
+// Moves the response to the send queue. A streamed CGI response gets
+// there while its request may still be sending the body.
+void Webserv::_pushResponse( ClientData& client_data ) {
+	if (!client_data.response.keep_alive) {
+		client_data.closing = true;
+	}
+	client_data.last_location = client_data.response.location;
+	AccessRecord& access = client_data.response.access_record;
+	access.status = client_data.response.statusCode();
+	if (static_cast<size_t>(access.status) < WorkerMetrics::max_status) {
+		_metrics.requests[access.status].add();
+	}
+	access.accepted = client_data.accepted_at;
+	access.ready = AccessLog::now();
+	if (client_data.response.header_only) {
+		client_data.response.dropBody();
+	}
+	client_data.responses.push_back(std::move(client_data.response));
+	client_data.response = Response();
+}
+
+// Starts the next request with whatever was received past the end of the current one
+void Webserv::_finishRequest( ClientData& client_data ) {
+	client_data.request.reset();
+	client_data.requests_served += 1;
+}
+
+int Webserv::_getClientRequest( int client_fd ) {
+	Request& request = _clients_map[client_fd].request;
+	if (request.status == NEW) {
 		request.status = request.parseRequest();
+		if (request.status == NEW) {
+			return 2;
+		}
+		ClientData& client_data = _clients_map[client_fd];
+		AccessRecord& access = client_data.response.access_record;
+		access.headers = AccessLog::now();
+		access.method = request.method;
+		if (_access_log) {
+			access.path = request.getPath();
+		}
+		_checkKeepAlive(client_data);
 		if (request.status != INVALID) {
-			_getTargetServer(client_fd, request.headers["Host"]);
+			_getTargetServer(client_fd, request.getHeader("Host"));
+			if (!client_data.server->server_names.empty()) {
+				access.vhost = client_data.server->server_names.front();
+			}
 			if (_getTargetLocation(client_fd)) return 4;
 			if (_checkRequestValid(request, client_fd)) return 3;
 		}
 	} else if (request.status == FULL_HEADER) {
 		request.status = request.getRequestBody();
+		_checkKeepAlive(_clients_map[client_fd]);
+		if (request.status != INVALID && _checkBodySize(request, client_fd)) return 3;
 	}
 	if (logger.getLevel() == DEBUG && request.status == FULL_BODY) {
 		request.printRequest();
 	}
-	_clients_map[client_fd].last_activity = time(nullptr);
+	// a CGI is started as soon as the headers are in and gets the body
+	// streamed; chunked bodies are collected first to know CONTENT_LENGTH
+	if (request.status == FULL_HEADER && !request.isChunked()
+		&& Response::isCgiPath(request.getPath())) {
+		return 0;
+	}
 	if (request.status == NEW || request.status == FULL_HEADER) {
 		return 2;
 	}
@@ -91,22 +297,18 @@ int Webserv::_getClientRequest( int client_fd ) {
 }
 
 int Webserv::_getTargetLocation( int client_fd ) {
-	std::vector<Location>& locations = _clients_map[client_fd].server->locations;
-	std::string& path = _clients_map[client_fd].request.path;
+	ServerData& server = *_clients_map[client_fd].server;
+	std::string_view path = _clients_map[client_fd].request.getPath();
 	Response& response = _clients_map[client_fd].response;
-	logger.info("PATH: " + path);
-	for (auto& location : locations) {
-		if (path.compare(0, location.path.size(), location.path) == 0) {
-			response.location = &location;
-			if (path.front() != '/') path.insert(0, 1, '/');
-			logger.debug("Found Path: " + location.path);
-			return 0;
-		}
-	}
-	if (response.location == nullptr) {
-		response.prepareResponseError(404);
-		_modifyEpollSocketOut(client_fd);
+	logger.debug("PATH: ", path);
+	int index = server.router.find(path);
+	if (index != -1) {
+		response.location = &server.locations[index];
+		response.access_record.routed = AccessLog::now();
+		logger.debug("Found Path: ", response.location->path);
+		return 0;
 	}
+	response.prepareResponseError(404);
 	return 1;
 }
 
@@ -117,95 +319,309 @@ int Webserv::_checkRequestValid( const Request& request, int client_fd ) {
 	std::set<Method>& methods = location->allowed_methods;
 	if (methods.find(request.method) == methods.end()) {
 		response.prepareResponseError(405);
-		_modifyEpollSocketOut(client_fd);
 		return 1;
 	}
-	if (request.content_length > location->client_max_body_size) {
-		response.prepareResponseError(413);
-		_modifyEpollSocketOut(client_fd);
+	if (_checkBodySize(request, client_fd)) {
 		return 1;
 	}
 	if (!location->redirect_path.empty()) {
-		response.full_response = "HTTP/1.1 " + std::to_string(location->redirect_code) + " ";
+		std::string header = "HTTP/1.1 " + std::to_string(location->redirect_code) + " ";
 		if (location->redirect_code == 301 ) {
-			response.full_response += "Moved Permanently\r\n";
+			header += "Moved Permanently\r\n";
 		} else if (location->redirect_code == 302) {
-			response.full_response += "Found\r\n";
+			header += "Found\r\n";
 		}
-		response.full_response += "Location: " + location->redirect_path + "\r\nContent-Length: 0\r\n\r\n";
-		_modifyEpollSocketOut(client_fd);
+		header += "Location: " + location->redirect_path + "\r\n";
+		header += response.getConnectionHeader() + "Content-Length: 0\r\n\r\n";
+		response.clearSegments();
+		response.appendOwned(std::move(header));
+		return 1;
+	}
+	return 0;
+}
+
+// Chunked bodies grow while they are decoded, so this also runs on every
+// received part of the body
+int Webserv::_checkBodySize( const Request& request, int client_fd ) {
+	Response& response = _clients_map[client_fd].response;
+	if (request.content_length > response.location->client_max_body_size) {
+		response.prepareResponseError(413);
 		return 1;
 	}
 	return 0;
 }
 
+// A response keeps the connection open only once its request was read completely
+void Webserv::_checkKeepAlive( ClientData& client_data ) {
+	Request& request = client_data.request;
+	std::string connection(request.getHeader("Connection"));
+	std::transform(connection.begin(), connection.end(), connection.begin(), ::tolower);
+	const Location* location = client_data.response.location;
+	int keepalive_timeout = location ? location->keepalive_timeout : _keepalive_timeout;
+	client_data.response.keep_alive = request.status == FULL_BODY
+		&& connection != "close"
+		&& keepalive_timeout > 0
+		&& client_data.requests_served + 1 < _keepalive_requests;
+}
+
+// Memory segments up to the next file range go out in one sendmsg(), file
+// ranges with sendfile(). Level mode sends at most _chunk_size bytes of
+// memory per event, edge mode hands the kernel all of it and stops once
+// it takes less.
 void Webserv::_sendClientResponse( int client_fd ) {
-	std::string& response = _clients_map[client_fd].response.full_response;
-	size_t bytes_sent_total = _clients_map[client_fd].bytes_sent_total;
-	std::size_t chunk_size = _chunk_size;
-	if (response.size() == bytes_sent_total) {
-		logger.debug("Nothing to send");
-		_closeClientFd(client_fd, nullptr);
-		return;
-	} else if (response.size() - bytes_sent_total < _chunk_size) {
-		chunk_size = response.size() - bytes_sent_total;
+	ClientData& client_data = _clients_map[client_fd];
+	if (client_data.responses.empty()) {
+		return _updateClientEvents(client_fd);
+	}
+	Response& response = client_data.responses.front();
+	if (response.pendingSize() == 0) {
+		if (response.streaming) {
+			return _waitForCgiOutput(client_fd);
+		}
+		return _finishResponse(client_fd);
+	}
+	size_t wanted;
+	size_t file_sent;
+	ssize_t bytes_sent;
+	if (const ResponseSegment* file = response.frontFile(file_sent)) {
+		off_t offset = file->file_offset + file_sent;
+		wanted = file->file_length - file_sent;
+		bytes_sent = sendfile(client_fd, response.file_fd, &offset, wanted);
+	} else {
+		const int max_iovecs = 16;
+		iovec iov[max_iovecs];
+		msghdr message = {};
+		message.msg_iov = iov;
+		message.msg_iovlen = response.fillIovec(iov, max_iovecs,
+			_edge_triggered ? SIZE_MAX : _chunk_size, wanted);
+		bytes_sent = sendmsg(client_fd, &message, MSG_NOSIGNAL);
 	}
-	std::string_view chunk(response.c_str() + bytes_sent_total, chunk_size);
-	ssize_t bytes_sent = send(client_fd, chunk.data(), chunk_size, 0);
-	logger.debug(std::to_string(bytes_sent) + " bytes sent to client_fd " + std::to_string(client_fd));
-	if (bytes_sent <= 0) {
+	logger.debug(bytes_sent, " bytes sent to client_fd ", client_fd);
+	if (bytes_sent < 0 && _edge_triggered) {
+		client_data.write_blocked = true;
+	} else if (bytes_sent <= 0) {
 		_closeClientFd(client_fd, "send: error");
-	} else if (bytes_sent + bytes_sent_total == response.size()) {
-		_closeClientFd(client_fd, nullptr);
 	} else {
-		_clients_map[client_fd].bytes_sent_total += bytes_sent;
-		_clients_map[client_fd].last_activity = time(nullptr);
+		response.consume(bytes_sent);
+		response.access_record.bytes_sent += bytes_sent;
+		_metrics.bytes_sent.add(bytes_sent);
+		client_data.last_activity = _now;
+		client_data.write_blocked = static_cast<size_t>(bytes_sent) < wanted;
+		if (response.pendingSize() > 0) {
+			return;
+		}
+		response.access_record.last_byte = AccessLog::now();
+		if (response.streaming) {
+			return _waitForCgiOutput(client_fd);
+		}
+		_finishResponse(client_fd);
+	}
+}
+
+// Everything the CGI produced so far was sent, the socket is left alone
+// until more output arrives
+void Webserv::_waitForCgiOutput( int client_fd ) {
+	ClientData& client_data = _clients_map[client_fd];
+	client_data.last_activity = _now;
+	client_data.cgi.socket_full = false;
+	_updateClientEvents(client_fd);
+}
+
+void Webserv::_finishResponse( int client_fd ) {
+	ClientData& client_data = _clients_map[client_fd];
+	Response& response = client_data.responses.front();
+	bool keep_alive = response.keep_alive;
+	AccessRecord& access = response.access_record;
+	if (access.last_byte == 0) {
+		access.last_byte = AccessLog::now();
+	}
+	if (access.headers != 0) {
+		_metrics.request_time.record(access.last_byte - access.headers);
+	}
+	_logAccess(client_data, response, true);
+	client_data.responses.pop_front();
+	if (!keep_alive) {
+		return _closeClientFd(client_fd, nullptr);
 	}
+	client_data.last_activity = _now;
+	_processClientRequests(client_fd);
 }
 
+// Body bytes are dropped from the request once written, so the buffer
+// between client socket and CGI stdin stays bounded by _cgi_buffer_size
 void Webserv::_sendCgiRequest( int fd_out ) {
 	int client_fd = _pipe_map[fd_out];
 	ClientData& client_data = _clients_map[client_fd];
 	Request& request = client_data.request;
-	size_t bytes_write_total = client_data.bytes_write_total;
-	if (bytes_write_total == request.body.size()) {
+	std::string_view body = request.getBody();
+	if (body.empty() && request.status == FULL_BODY) {
 		return _closeCgiPipe(fd_out, client_data.cgi, nullptr);
+	} else if (body.empty()) {
+		return _updateClientEvents(client_fd);
 	}
-	size_t chunk_size = _chunk_size;
-	if (request.body.size() - bytes_write_total < _chunk_size) {
-		chunk_size = request.body.size() - bytes_write_total;
-	}
-	std::string_view chunk(request.body.c_str() + bytes_write_total, chunk_size);
-	ssize_t bytes = write(fd_out, chunk.data(), chunk_size);
-	client_data.last_activity = time(nullptr);
+	std::string_view chunk = body.substr(0, _chunk_size);
+	ssize_t bytes = write(fd_out, chunk.data(), chunk.size());
+	client_data.last_activity = _now;
 	if (bytes <= 0) {
-		client_data.response.prepareResponseError(500);
-		_modifyEpollSocketOut(client_fd);
-		return _closeCgiPipe(client_data.cgi.fd_in, client_data.cgi, "write pipe: ");
+		// the CGI stopped reading its input, its output still makes the response
+		_closeCgiPipe(fd_out, client_data.cgi, nullptr);
+		return _updateClientEvents(client_fd);
 	}
-	_clients_map[client_fd].bytes_write_total += bytes;
-	logger.debug("Body size: " + std::to_string(request.body.size()) + " bytes write: " + std::to_string(bytes));
+	request.consumeBody(bytes);
+	client_data.bytes_write_total += bytes;
+	logger.debug("Body bytes written to CGI: ", client_data.bytes_write_total);
+	_updateClientEvents(client_fd);
+}
+
+// Called when body bytes for a running CGI were received
+void Webserv::_streamCgiBody( int client_fd ) {
+	ClientData& client_data = _clients_map[client_fd];
+	Request& request = client_data.request;
+	if (request.status == FULL_HEADER) {
+		request.status = request.getRequestBody();
+		_checkKeepAlive(client_data);
+	}
+	if (client_data.cgi.fastcgi != nullptr) {
+		_sendFastCgiBody(client_fd);
+	}
+	_updateClientEvents(client_fd);
 }
 
 void Webserv::_getCgiResponse( int fd_in ) {
 	int client_fd = _pipe_map[fd_in];
-	ClientData& client_data = _clients_map[client_fd];
-	Response& response = client_data.response;
+	if (_clients_map[client_fd].cgi.splicing) {
+		return _spliceCgiResponse(client_fd);
+	}
 	char buffer[_chunk_size];
 	ssize_t bytes = read(fd_in, buffer, sizeof(buffer));
-	client_data.last_activity = time(nullptr);
-	logger.debug("bytes read from pipe: " + std::to_string(bytes));
+	logger.debug("bytes read from pipe: ", bytes);
 	if (bytes < 0) {
-		response.prepareResponseError(500);
-		_modifyEpollSocketOut(client_fd);
-		return _closeCgiPipe(fd_in, client_data.cgi, "read pipe: ");
-	} else if (bytes > 0) {
-		response.full_response.append(buffer, bytes);
-	}
-	if (bytes == 0) {
-		response.handleCgiResponse();
-		logger.debug(response.full_response);
-		_modifyEpollSocketOut(client_fd);
-		_closeCgiPipe(fd_in, client_data.cgi, nullptr);
+		return _abortCgi(client_fd, "read pipe: ");
+	}
+	_receiveCgiOutput(client_fd, std::string_view(buffer, bytes), bytes == 0);
+}
+
+// Output up to the end of the CGI header block is collected in the current
+// response, the body after it is appended to the queued one as it arrives
+void Webserv::_receiveCgiOutput( int client_fd, std::string_view data, bool eof ) {
+	ClientData& client_data = _clients_map[client_fd];
+	client_data.last_activity = _now;
+	if (!client_data.cgi.headers_done) {
+		std::string& output = client_data.response.cgi_header;
+		output.append(data);
+		if (eof || output.find("\r\n\r\n") != std::string::npos) {
+			return _startCgiResponse(client_fd, eof);
+		} else if (output.size() > _cgi_buffer_size) {
+			return _abortCgi(client_fd, nullptr);
+		}
+		return;
+	}
+	if (eof) {
+		return _finishCgiResponse(client_fd);
+	}
+	client_data.responses.back().appendCgiBody(data);
+	_updateClientEvents(client_fd);
+}
+
+// The response is queued as soon as the CGI header block is complete
+void Webserv::_startCgiResponse( int client_fd, bool eof ) {
+	ClientData& client_data = _clients_map[client_fd];
+	Response& response = client_data.response;
+	if (response.handleCgiResponse() != 0) {
+		_markCgiExit(response);
+		_closeCgi(client_data.cgi, nullptr);
+		_queueResponse(client_fd);
+		return _processClientRequests(client_fd);
+	}
+	logger.debug("CGI response header of ", response.pendingSize(), " bytes for client_fd ", client_fd);
+	client_data.cgi.headers_done = true;
+	// FastCGI output arrives framed in records, only a pipe can be spliced
+	client_data.cgi.splicing = client_data.cgi.fastcgi == nullptr && !response.header_only
+							   && !response.chunked_body && response.body_remaining > 0;
+	_pushResponse(client_data);
+	if (eof) {
+		return _finishCgiResponse(client_fd);
+	}
+	_updateClientEvents(client_fd);
+}
+
+// With a Content-Length the body goes from the pipe to the socket without
+// a copy through user space. Only called once everything queued before it
+// was sent, see _updateCgiEvents.
+void Webserv::_spliceCgiResponse( int client_fd ) {
+	ClientData& client_data = _clients_map[client_fd];
+	Response& response = client_data.responses.back();
+	ssize_t bytes = splice(client_data.cgi.fd_in, nullptr, client_fd, nullptr,
+						   response.body_remaining, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	logger.debug(bytes, " bytes spliced to client_fd ", client_fd);
+	if (bytes < 0) {
+		// the pipe was readable, so the socket is full
+		client_data.cgi.socket_full = true;
+		return _updateClientEvents(client_fd);
+	} else if (bytes == 0) {
+		return _finishCgiResponse(client_fd);
+	}
+	client_data.last_activity = _now;
+	response.access_record.bytes_sent += bytes;
+	response.access_record.last_byte = AccessLog::now();
+	_metrics.bytes_sent.add(bytes);
+	response.body_remaining -= bytes;
+	if (response.body_remaining == 0) {
+		// anything the CGI writes past its Content-Length is read and dropped
+		client_data.cgi.splicing = false;
+	}
+}
+
+// The CGI closed its output, the response is done once the queue is sent
+void Webserv::_finishCgiResponse( int client_fd ) {
+	ClientData& client_data = _clients_map[client_fd];
+	Response& response = client_data.responses.back();
+	response.finishCgiBody();
+	_markCgiExit(response);
+	if (!response.keep_alive) {
+		client_data.closing = true;
+	}
+	_closeCgi(client_data.cgi, nullptr);
+	_finishRequest(client_data);
+	_processClientRequests(client_fd);
+}
+
+// Before the CGI header block a failed CGI is answered with a 500, after
+// it the response is cut short by closing the connection
+void Webserv::_abortCgi( int client_fd, const char* err_msg, size_t status_code ) {
+	ClientData& client_data = _clients_map[client_fd];
+	if (client_data.cgi.headers_done) {
+		Response& response = client_data.responses.back();
+		response.streaming = false;
+		response.keep_alive = false;
+		_markCgiExit(response);
+		client_data.closing = true;
+	} else {
+		client_data.response.prepareResponseError(status_code);
+		_markCgiExit(client_data.response);
+		_pushResponse(client_data);
+	}
+	_closeCgi(client_data.cgi, err_msg);
+	_finishRequest(client_data);
+	_processClientRequests(client_fd);
+}
+
+// last_byte is stamped whenever the queued bytes ran out. A response cut
+// short by a closed connection keeps no time for it.
+void Webserv::_logAccess( ClientData& client_data, Response& response, bool complete ) {
+	if (!_access_log) {
+		return;
+	}
+	if (!complete) {
+		response.access_record.last_byte = 0;
+	}
+	_access_log->write(client_data.address, response.access_record);
+}
+
+void Webserv::_markCgiExit( Response& response ) {
+	AccessRecord& access = response.access_record;
+	access.cgi_exit = AccessLog::now();
+	if (access.cgi_spawn != 0) {
+		_metrics.cgi_time.record(access.cgi_exit - access.cgi_spawn);
 	}
 }
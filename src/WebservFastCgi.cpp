@@ -0,0 +1,311 @@
+#include "Webserv.hpp"
+
+// Returns 1 when no backend connection could be opened and the 502 response is ready
+int Webserv::_executeFastCgi( int client_fd ) {
+	ClientData& client_data = _clients_map[client_fd];
+	Location* location = client_data.response.location;
+	FastCgiPool& pool = _fastcgi_pools[location->fastcgi_pass];
+	if (pool.address.empty()) {
+		pool.address = location->fastcgi_pass;
+		pool.max_connections = location->fastcgi_connections;
+	}
+	FastCgiConnection* conn = _getFastCgiConnection(pool);
+	if (conn == nullptr) {
+		client_data.response.prepareResponseError(502);
+		return 1;
+	}
+	client_data.cgi.client_fd = client_fd;
+	client_data.cgi.fastcgi = conn;
+	client_data.response.access_record.cgi_spawn = AccessLog::now();
+	if (conn->canBegin()) {
+		_beginFastCgiRequest(*conn, client_fd);
+	} else {
+		conn->queued.push_back(client_fd);
+	}
+	return 0;
+}
+
+// An idle connection first, then a new one while the pool has room, then
+// the least busy one, which multiplexes or queues the request
+FastCgiConnection* Webserv::_getFastCgiConnection( FastCgiPool& pool ) {
+	FastCgiConnection* least_busy = nullptr;
+	for (FastCgiConnection& conn : pool.connections) {
+		if (conn.load() == 0) {
+			return &conn;
+		} else if (least_busy == nullptr || conn.load() < least_busy->load()) {
+			least_busy = &conn;
+		}
+	}
+	if (pool.connections.size() < pool.max_connections) {
+		FastCgiConnection* conn = _openFastCgiConnection(pool);
+		if (conn != nullptr) {
+			return conn;
+		}
+	}
+	return least_busy;
+}
+
+// connect() is not waited for: -1 mostly means it is in progress, a
+// failure shows up on the first event of the socket
+FastCgiConnection* Webserv::_openFastCgiConnection( FastCgiPool& pool ) {
+	sockaddr_storage addr;
+	socklen_t addr_len;
+	if (_resolveFastCgiAddress(pool.address, addr, addr_len) != 0) {
+		return nullptr;
+	}
+	int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		perror("socket: fastcgi");
+		return nullptr;
+	}
+	bool connected = connect(fd, reinterpret_cast<sockaddr*>(&addr), addr_len) == 0;
+	FastCgiConnection& conn = pool.connections.emplace_back(pool, fd);
+	conn.connected = connected;
+	conn.epoll_events = EPOLLIN | EPOLLOUT;
+	conn.getValues();
+	epoll_event event;
+	event.events = conn.epoll_events;
+	event.data.fd = fd;
+	if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+		perror("epoll_ctl: add fastcgi");
+		close(fd);
+		pool.connections.pop_back();
+		return nullptr;
+	}
+	_fastcgi_map[fd] = &conn;
+	logger.debug("FastCGI connection ", fd, " to ", pool.address);
+	return &conn;
+}
+
+// "unix:/path/to.sock" or "ip:port"
+int Webserv::_resolveFastCgiAddress( const std::string& address, sockaddr_storage& addr,
+									 socklen_t& addr_len ) {
+	std::memset(&addr, 0, sizeof(addr));
+	if (address.compare(0, 5, "unix:") == 0) {
+		sockaddr_un* unix_addr = reinterpret_cast<sockaddr_un*>(&addr);
+		std::string path = address.substr(5);
+		if (path.empty() || path.size() >= sizeof(unix_addr->sun_path)) {
+			return 1;
+		}
+		unix_addr->sun_family = AF_UNIX;
+		std::memcpy(unix_addr->sun_path, path.c_str(), path.size() + 1);
+		addr_len = sizeof(sockaddr_un);
+		return 0;
+	}
+	size_t delimiter = address.rfind(':');
+	if (delimiter == std::string::npos) {
+		return 1;
+	}
+	sockaddr_in* inet_addr = reinterpret_cast<sockaddr_in*>(&addr);
+	std::string host = address.substr(0, delimiter);
+	if (host == "localhost") {
+		host = "127.0.0.1";
+	}
+	int port = std::atoi(address.c_str() + delimiter + 1);
+	if (inet_pton(AF_INET, host.c_str(), &inet_addr->sin_addr) != 1 || port <= 0 || port > 65535) {
+		return 1;
+	}
+	inet_addr->sin_family = AF_INET;
+	inet_addr->sin_port = htons(port);
+	addr_len = sizeof(sockaddr_in);
+	return 0;
+}
+
+// The CGI environment becomes FCGI_PARAMS, plus the script path the
+// backend needs since it does not get it as argv
+void Webserv::_beginFastCgiRequest( FastCgiConnection& conn, int client_fd ) {
+	ClientData& client_data = _clients_map[client_fd];
+	std::vector<std::string> env_strings;
+	_createEnvs(client_data.request, env_strings);
+	std::vector<std::pair<std::string, std::string>> params;
+	for (const std::string& env : env_strings) {
+		size_t delimiter = env.find('=');
+		params.emplace_back(env.substr(0, delimiter), env.substr(delimiter + 1));
+	}
+	char script_path[PATH_MAX];
+	const std::string& local_path = client_data.response.local_path;
+	params.emplace_back("SCRIPT_FILENAME",
+		realpath(local_path.c_str(), script_path) != nullptr ? script_path : local_path);
+	params.emplace_back("SCRIPT_NAME", client_data.request.getPath());
+	client_data.cgi.request_id = conn.beginRequest(client_fd, params);
+	_sendFastCgiBody(client_fd);
+}
+
+// Without multiplexing the next request waits for the previous to end
+void Webserv::_startQueuedFastCgi( FastCgiConnection& conn ) {
+	while (!conn.queued.empty() && (conn.requests.empty() || conn.multiplexing)) {
+		int client_fd = conn.queued.front();
+		conn.queued.pop_front();
+		_beginFastCgiRequest(conn, client_fd);
+		_updateClientEvents(client_fd);
+	}
+}
+
+// Received body bytes become FCGI_STDIN records while the connection has
+// room for them, an empty record ends the body
+void Webserv::_sendFastCgiBody( int client_fd ) {
+	ClientData& client_data = _clients_map[client_fd];
+	CgiData& cgi = client_data.cgi;
+	if (cgi.request_id == 0 || cgi.stdin_done) {
+		return;
+	}
+	FastCgiConnection& conn = *cgi.fastcgi;
+	Request& request = client_data.request;
+	while (conn.pendingOut() < _cgi_buffer_size && !request.getBody().empty()) {
+		std::string_view chunk = request.getBody().substr(0, _cgi_buffer_size);
+		conn.addStdin(cgi.request_id, chunk);
+		request.consumeBody(chunk.size());
+		client_data.bytes_write_total += chunk.size();
+	}
+	if (request.getBody().empty() && request.status == FULL_BODY) {
+		conn.addStdin(cgi.request_id, "");
+		cgi.stdin_done = true;
+	}
+}
+
+void Webserv::_handleFastCgiEvent( FastCgiConnection& conn, uint32_t events ) {
+	if (!conn.connected) {
+		int error = 0;
+		socklen_t error_len = sizeof(error);
+		getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &error, &error_len);
+		if (error != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+			return _closeFastCgiConnection(conn, "connect failed");
+		}
+		conn.connected = true;
+	}
+	if ((events & EPOLLOUT) && _sendFastCgi(conn) != 0) {
+		return;
+	}
+	if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+		_recvFastCgi(conn);
+	}
+}
+
+// Returns 1 when the connection failed and was closed
+int Webserv::_sendFastCgi( FastCgiConnection& conn ) {
+	if (conn.pendingOut() > 0) {
+		ssize_t bytes = write(conn.fd, conn.out.data() + conn.out_sent, conn.pendingOut());
+		if (bytes <= 0) {
+			_closeFastCgiConnection(conn, "write failed");
+			return 1;
+		}
+		conn.out_sent += bytes;
+	}
+	conn.compact();
+	// the written records make room for more of the request bodies
+	std::vector<int> clients;
+	for (const auto& [request_id, client_fd] : conn.requests) {
+		if (client_fd != -1) clients.push_back(client_fd);
+	}
+	for (int client_fd : clients) {
+		_sendFastCgiBody(client_fd);
+		_updateClientEvents(client_fd);
+	}
+	_updateFastCgiEvents(conn);
+	return 0;
+}
+
+void Webserv::_recvFastCgi( FastCgiConnection& conn ) {
+	char buffer[_chunk_size];
+	ssize_t bytes = read(conn.fd, buffer, sizeof(buffer));
+	logger.debug(bytes, " bytes read from FastCGI connection ", conn.fd);
+	if (bytes <= 0) {
+		// an idle connection may be dropped by the backend at any time
+		return _closeFastCgiConnection(conn, conn.load() > 0 ? "closed by the backend" : nullptr);
+	}
+	conn.in.append(buffer, bytes);
+	FastCgiRecord record;
+	while (conn.nextRecord(record)) {
+		_handleFastCgiRecord(conn, record);
+	}
+	conn.compact();
+	_updateFastCgiEvents(conn);
+}
+
+// Records of aborted requests are dropped, their ids are freed when they end
+void Webserv::_handleFastCgiRecord( FastCgiConnection& conn, const FastCgiRecord& record ) {
+	if (record.type == FCGI_GET_VALUES_RESULT) {
+		auto values = FastCgiConnection::parseNameValues(record.content);
+		conn.multiplexing = values["FCGI_MPXS_CONNS"] == "1";
+		return _startQueuedFastCgi(conn);
+	}
+	auto it = conn.requests.find(record.request_id);
+	if (it == conn.requests.end()) {
+		return;
+	}
+	int client_fd = it->second;
+	if (record.type == FCGI_STDERR) {
+		logger.warning("FastCGI: ", record.content);
+	} else if (record.type == FCGI_STDOUT && client_fd != -1) {
+		_receiveCgiOutput(client_fd, record.content, false);
+	} else if (record.type == FCGI_END_REQUEST) {
+		conn.requests.erase(it);
+		// any protocolStatus but FCGI_REQUEST_COMPLETE means the request was refused
+		bool complete = record.content.size() >= 5 && record.content[4] == 0;
+		if (client_fd != -1) {
+			_clients_map[client_fd].cgi.request_id = 0;
+			if (complete) {
+				_receiveCgiOutput(client_fd, "", true);
+			} else {
+				_abortCgi(client_fd, nullptr, 502);
+			}
+		}
+		_startQueuedFastCgi(conn);
+	}
+}
+
+// The backend may still be running an abandoned request, so its id stays
+// taken until the backend ends it
+void Webserv::_releaseFastCgiRequest( CgiData& cgi ) {
+	FastCgiConnection& conn = *cgi.fastcgi;
+	if (cgi.request_id != 0) {
+		conn.abortRequest(cgi.request_id);
+	} else {
+		conn.queued.erase(std::remove(conn.queued.begin(), conn.queued.end(), cgi.client_fd),
+						  conn.queued.end());
+	}
+	_updateFastCgiEvents(conn);
+}
+
+// Requests on a failed connection are answered with a 502, or cut short
+// when their response already started
+void Webserv::_closeFastCgiConnection( FastCgiConnection& conn, const char* reason ) {
+	if (reason != nullptr) {
+		logger.warning("FastCGI ", conn.pool.address, ": ", reason);
+	}
+	std::vector<int> clients(conn.queued.begin(), conn.queued.end());
+	for (const auto& [request_id, client_fd] : conn.requests) {
+		if (client_fd != -1) clients.push_back(client_fd);
+	}
+	FastCgiPool& pool = conn.pool;
+	_fastcgi_map.erase(conn.fd);
+	close(conn.fd);
+	pool.connections.remove_if([&conn]( const FastCgiConnection& other ) { return &other == &conn; });
+	for (int client_fd : clients) {
+		_clients_map[client_fd].cgi.fastcgi = nullptr;
+		_abortCgi(client_fd, nullptr, 502);
+	}
+}
+
+// The connection is read unless a client is behind on the output of one of
+// its requests, and written while records are pending or connect() runs
+void Webserv::_updateFastCgiEvents( FastCgiConnection& conn ) {
+	uint32_t events = EPOLLIN;
+	for (const auto& [request_id, client_fd] : conn.requests) {
+		if (client_fd != -1 && _pendingCgiOutput(_clients_map[client_fd]) >= _cgi_buffer_size) {
+			events = 0;
+		}
+	}
+	if (!conn.connected || conn.pendingOut() > 0) {
+		events |= EPOLLOUT;
+	}
+	if (events == conn.epoll_events) {
+		return;
+	}
+	epoll_event event;
+	event.events = events;
+	event.data.fd = conn.fd;
+	if (epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, conn.fd, &event) == 0) {
+		conn.epoll_events = events;
+	}
+}
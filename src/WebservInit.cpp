@@ -1,5 +1,26 @@
 #include "Webserv.hpp"
 
+int Webserv::_initWorkers( void ) {
+	for (size_t worker_id = 1; worker_id < _worker_threads; ++worker_id) {
+		_workers.emplace_back(new Webserv(*this, worker_id));
+	}
+	if (_initWebserv() != 0) {
+		return -1;
+	}
+	for (auto& worker : _workers) {
+		if (worker->_initWebserv() != 0) {
+			return _initError("Failed to init worker", -1);
+		}
+	}
+	_listen_overflows_start = _readListenOverflows();
+	logger.info("Webserv is running now with ", _worker_threads, " worker thread(s)");
+	signal(SIGINT, handleSigInt);
+	signal(SIGHUP, handleSigHup);
+	// a client or CGI that went away shows up as a failed write instead
+	signal(SIGPIPE, SIG_IGN);
+	return 0;
+}
+
 int Webserv::_initWebserv( void ) {
 	std::unordered_map<std::string, int> listen_map;
 	for (ServerData& server : _servers) {
@@ -7,17 +28,23 @@ int Webserv::_initWebserv( void ) {
 			return -1;
 		}
 	}
-	_epoll_fd = epoll_create(1);
+	_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 	if (_epoll_fd == -1) {
 		return _initError("Failed to create epoll", -1);
 	}
+	_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (_wake_fd == -1 || _addServerToEpoll(_wake_fd) != 0) {
+		return _initError("Failed to create wake eventfd", -1);
+	}
+	if (_initCaches() != 0) {
+		return _initError("Failed to init response caches", -1);
+	}
 	for (const auto& [server_fd, server_ptr] : _server_sockets_map) {
 		if (_addServerToEpoll(server_fd) != 0) {
 			return -1;
 		}
 	}
-	logger.info("Webserv is running now");
-	signal(SIGINT, handleSigInt);
+	_fillPreforkPool();
 	return 0;
 }
 
@@ -34,13 +61,46 @@ int Webserv::_initServer( ServerData& server, std::unordered_map<std::string, in
 		} else {
 			server_fd = listen_map[ip_port];
 		}
-		_server_sockets_map[server_fd].push_back(&server);
+		const auto& defaults = server.default_server_for;
+		bool default_server = std::find(defaults.begin(), defaults.end(), std::make_pair(ip_address, port)) != defaults.end();
+		if (_addVirtualHost(_server_sockets_map[server_fd], server, default_server) != 0) {
+			return _initError("Failed to add server", -1);
+		}
+	}
+	return 0;
+}
+
+// "*.example.com" matches the names below example.com, ".example.com"
+// also example.com itself. A name already taken keeps its first server.
+int Webserv::_addVirtualHost( ListenerData& listener, ServerData& server, bool default_server ) {
+	if (default_server) {
+		if (listener.explicit_default && listener.default_server != &server) {
+			logger.error("Duplicate default_server on one listener");
+			return 1;
+		}
+		listener.default_server = &server;
+		listener.explicit_default = true;
+	} else if (listener.default_server == nullptr) {
+		listener.default_server = &server;
+	}
+	for (std::string name : server.server_names) {
+		std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+		auto& names = name.front() == '*' || name.front() == '.' ? listener.wildcard_names : listener.names;
+		if (name.front() == '*') {
+			name.erase(0, 1);
+		} else if (name.front() == '.') {
+			listener.names.emplace(name.substr(1), &server);
+		}
+		auto [it, inserted] = names.emplace(name, &server);
+		if (!inserted && it->second != &server) {
+			logger.warning("Conflicting server name ", name, ", ignored");
+		}
 	}
 	return 0;
 }
 
 int Webserv::_createServerSocket( uint32_t ip_address, uint16_t port ) {
-	int server_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	int server_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
 	if (server_fd == -1) {
 		return _initError("Failed to create socket", -1);
 	}
@@ -52,6 +112,11 @@ int Webserv::_createServerSocket( uint32_t ip_address, uint16_t port ) {
 	if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
 		return _initError("Failed to set socket opt", server_fd);
 	}
+	// Every worker binds its own listener, the kernel balances accepts between them
+	if (_worker_threads > 1
+		&& setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
+		return _initError("Failed to set SO_REUSEPORT", server_fd);
+	}
 	if (bind(server_fd, (sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
 		return _initError("Failed to bind socket", server_fd);
 	}
@@ -74,11 +139,57 @@ int Webserv::_addServerToEpoll( const int server_fd ) {
 	return 0;
 }
 
+// Caches are created per worker, after the config was copied to it
+int Webserv::_initCaches( void ) {
+	for (ServerData& server : _servers) {
+		for (Location& location : server.locations) {
+			if (location.open_cache_size == 0 && !location.gzip) {
+				continue;
+			}
+			if (_inotify_fd == -1) {
+				_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+				if (_inotify_fd == -1 || _addServerToEpoll(_inotify_fd) != 0) {
+					return -1;
+				}
+			}
+			std::string server_name = server.server_names.empty() ? "_" : server.server_names.front();
+			if (location.open_cache_size != 0) {
+				location.cache = std::make_shared<ResponseCache>(location.open_cache_size, _inotify_fd);
+				_metrics.caches.push_back({server_name, location.path, "response", location.cache.get()});
+			}
+			if (location.gzip) {
+				location.gzip_cache = std::make_shared<ResponseCache>(location.gzip_cache_size, _inotify_fd);
+				_metrics.caches.push_back({server_name, location.path, "gzip", location.gzip_cache.get()});
+			}
+		}
+	}
+	return 0;
+}
+
 void Webserv::handleSigInt(int signum) {
 	(void)signum;
 	Webserv::getInstance()._stopServer();
 }
 
+// The main instance reloads the error pages on its next loop iteration
+void Webserv::handleSigHup(int signum) {
+	(void)signum;
+	Webserv& instance = Webserv::getInstance();
+	instance._reload_requested = true;
+	instance._wakeUp();
+}
+
+void Webserv::_loadErrorPages( void ) {
+	std::vector<std::pair<int, std::string>> error_pages;
+	for (const ServerData& server : _servers) {
+		for (const Location& location : server.locations) {
+			error_pages.insert(error_pages.end(), location.error_pages.begin(), location.error_pages.end());
+		}
+	}
+	Response::loadErrorPages(error_pages);
+	logger.info("Error pages loaded");
+}
+
 int Webserv::_initError( const char* err_msg, int fd ) {
 	perror(err_msg);
 	if (fd != -1) {
@@ -87,6 +198,12 @@ int Webserv::_initError( const char* err_msg, int fd ) {
 	for ( const auto& [server_fd, server_ptr] : _server_sockets_map ) {
 		close(server_fd);
 	}
+	if (_wake_fd != -1) {
+		close(_wake_fd);
+	}
+	if (_inotify_fd != -1) {
+		close(_inotify_fd);
+	}
 	if (_epoll_fd != -1) {
 		close(_epoll_fd);
 	}
@@ -10,20 +10,196 @@ int Webserv::_setNonBlocking( int fd ) {
 }
 
 void Webserv::_closeClientFd( int client_fd, const char* err_msg ) {
+	ClientData& client_data = _clients_map[client_fd];
+	if (!client_data.responses.empty() && client_data.responses.front().access_record.bytes_sent > 0) {
+		// a CGI may end its output after the client got all it announced
+		Response& front = client_data.responses.front();
+		bool complete = front.pendingSize() == 0
+			&& (!front.streaming || (!front.chunked_body && front.body_remaining == 0));
+		_logAccess(client_data, front, complete);
+	}
+	_metrics.connections[client_data.state].sub();
+	CgiData& cgi = client_data.cgi;
+	if (cgi.running()) {
+		_closeCgi(cgi, nullptr);
+	}
 	epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, client_fd, nullptr);
 	close(client_fd);
 	_clients_map.erase(client_fd);
 	if (err_msg != nullptr) {
 		perror(err_msg);
 	}
-	logger.debug("Connection was closed. Client_fd: " + std::to_string(client_fd));
+	logger.debug("Connection was closed. Client_fd: ", client_fd);
 }
 
-void Webserv::_modifyEpollSocketOut( int client_fd ) {
+// Reads while more requests may be answered or a CGI takes more body,
+// writes while responses are queued
+void Webserv::_updateClientEvents( int client_fd ) {
+	ClientData& client_data = _clients_map[client_fd];
+	uint32_t events = 0;
+	if (!client_data.responses.empty()) {
+		// a streamed CGI response is written only when it has output to send
+		const Response& front = client_data.responses.front();
+		if (!front.streaming || front.pendingSize() > 0 || client_data.cgi.socket_full) {
+			events |= EPOLLOUT;
+		}
+	}
+	bool can_read = !client_data.closing && client_data.responses.size() < _pipeline_depth;
+	if (client_data.cgi.running()) {
+		// while a CGI runs, only its request body is read, up to a bounded
+		// buffer, also when its response already closes the connection
+		const CgiData& cgi = client_data.cgi;
+		bool stdin_open = cgi.fastcgi != nullptr ? !cgi.stdin_done : cgi.fd_out != 0;
+		can_read = client_data.request.status == FULL_HEADER && stdin_open
+				   && client_data.request.getBody().size() < _cgi_buffer_size;
+		_updateCgiEvents(client_data);
+	}
+	if (can_read) {
+		events |= EPOLLIN;
+	}
+	ConnectionState state = CONN_IDLE;
+	if (client_data.cgi.running()) {
+		state = CONN_CGI;
+	} else if (!client_data.responses.empty()) {
+		state = CONN_WRITING;
+	} else if (!client_data.request.raw.empty()) {
+		state = CONN_READING;
+	}
+	_metrics.setState(client_data.state, state);
+	_scheduleTimeout(client_fd, client_data);
+	// EPOLL_CTL_MOD checks readiness again, so it also rearms an edge
+	bool rearm = client_data.rearm && (events & EPOLLIN);
+	client_data.rearm = false;
+	if (events == client_data.epoll_events && !rearm) {
+		return;
+	}
 	epoll_event event;
-	event.events = EPOLLOUT;
+	event.events = events | (_edge_triggered ? EPOLLET : 0u);
 	event.data.fd = client_fd;
 	if (epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, client_fd, &event) == -1) {
-		_closeClientFd(client_fd, "epoll_ctl: mod client_fd");
+		return _closeClientFd(client_fd, "epoll_ctl: mod client_fd");
+	}
+	client_data.epoll_events = events;
+}
+
+// CGI output is read while the part of it waiting to be sent stays bounded.
+// Spliced output is only read once nothing queued before it is left to send.
+void Webserv::_updateCgiEvents( ClientData& client_data ) {
+	CgiData& cgi = client_data.cgi;
+	if (cgi.fastcgi != nullptr) {
+		return _updateFastCgiEvents(*cgi.fastcgi);
+	}
+	bool readable = true;
+	if (cgi.headers_done) {
+		size_t pending = _pendingCgiOutput(client_data);
+		if (cgi.splicing) {
+			readable = client_data.responses.size() == 1 && pending == 0 && !cgi.socket_full;
+		} else {
+			readable = pending < _cgi_buffer_size;
+		}
+	}
+	_setPipeEvents(cgi.fd_in, cgi.in_events, readable ? EPOLLIN : 0u);
+	if (cgi.fd_out != 0) {
+		const Request& request = client_data.request;
+		bool has_body = !request.getBody().empty() || request.status == FULL_BODY;
+		_setPipeEvents(cgi.fd_out, cgi.out_events, has_body ? EPOLLOUT : 0u);
+	}
+}
+
+// CGI output received but not sent to the client yet
+size_t Webserv::_pendingCgiOutput( const ClientData& client_data ) const {
+	if (!client_data.cgi.headers_done) {
+		return client_data.response.cgi_header.size();
+	}
+	return client_data.responses.back().pendingSize();
+}
+
+// A paused pipe is taken out of epoll, since EPOLLHUP and EPOLLERR are
+// reported whatever the interest mask
+void Webserv::_setPipeEvents( int fd, uint32_t& current, uint32_t wanted ) {
+	if (current == wanted) {
+		return;
+	}
+	epoll_event event;
+	event.events = wanted;
+	event.data.fd = fd;
+	int op = EPOLL_CTL_MOD;
+	if (wanted == 0) {
+		op = EPOLL_CTL_DEL;
+	} else if (current == 0) {
+		op = EPOLL_CTL_ADD;
+	}
+	if (epoll_ctl(_epoll_fd, op, fd, &event) == 0) {
+		current = wanted;
+	}
+}
+
+void Webserv::_logCgiStats( void ) const {
+	const Histogram& latency = _metrics.cgi_spawn_time;
+	if (latency.count() == 0) {
+		return;
+	}
+	logger.info("Worker ", _worker_id, " CGI launches: ", _metrics.cgi_spawned.get(), " spawned, ",
+		_metrics.cgi_preforked.get(), " preforked, latency p50 ", latency.percentile(50), "us, p99 ",
+		latency.percentile(99), "us, max ", latency.max(), "us");
+}
+
+// Overflows are counted per network namespace, so only the main instance
+// reports them
+void Webserv::_logAcceptStats( void ) const {
+	logger.info("Worker ", _worker_id, " accepted ", _metrics.connections_accepted.get(), " connections, budget spent ",
+		_metrics.accept_budget_exhausted.get(), " times, accept queue peak ", _metrics.accept_queue_peak.get());
+	if (_worker_id == 0) {
+		logger.info("Listen queue overflows: ", _readListenOverflows() - _listen_overflows_start);
+	}
+}
+
+// stub_status: the counters of every worker, read while they keep counting
+void Webserv::_prepareMetrics( Response& response ) const {
+	std::vector<const WorkerMetrics*> workers = {&_master->_metrics};
+	for (const auto& worker : _master->_workers) {
+		workers.push_back(&worker->_metrics);
+	}
+	uint64_t listen_overflows = _readListenOverflows() - _master->_listen_overflows_start;
+	std::string body = WorkerMetrics::render(workers, listen_overflows);
+	response.clearSegments();
+	response.appendOwned("HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+		"Content-Length: " + std::to_string(body.size()) + "\r\nCache-Control: no-store\r\n"
+		+ response.getConnectionHeader() + "\r\n");
+	response.appendOwned(std::move(body));
+}
+
+// TcpExt ListenOverflows from /proc/net/netstat: SYNs and handshakes
+// dropped because an accept queue was full
+uint64_t Webserv::_readListenOverflows( void ) {
+	std::ifstream netstat("/proc/net/netstat");
+	std::string names;
+	std::string values;
+	while (std::getline(netstat, names) && std::getline(netstat, values)) {
+		if (names.compare(0, 7, "TcpExt:") != 0) continue;
+		std::istringstream name_stream(names);
+		std::istringstream value_stream(values);
+		std::string name;
+		std::string value;
+		while (name_stream >> name && value_stream >> value) {
+			if (name == "ListenOverflows") {
+				return std::stoull(value);
+			}
+		}
+	}
+	return 0;
+}
+
+void Webserv::_logCacheStats( void ) const {
+	for (const ServerData& server : _servers) {
+		for (const Location& location : server.locations) {
+			for (const auto& [name, cache] : {std::make_pair("cache ", location.cache.get()),
+											  std::make_pair("gzip cache ", location.gzip_cache.get())}) {
+				if (cache == nullptr) continue;
+				logger.info("Worker ", _worker_id, " ", name, location.path, ": hits ", cache->hits(),
+					", misses ", cache->misses(), ", ", cache->count(), " entries, ", cache->size(),
+					" bytes");
+			}
+		}
 	}
 }
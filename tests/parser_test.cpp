@@ -0,0 +1,60 @@
+// Request parser checks for message framing: a body must never be read as
+// the next pipelined request. Exits non-zero when a case fails.
+
+#include <iostream>
+#include <string>
+
+#include "Request.hpp"
+
+static const std::string g_smuggled = "GET /admin HTTP/1.1\r\nHost: x\r\n\r\n";
+
+static int g_failures = 0;
+
+static void check( bool condition, const std::string& name ) {
+	std::cout << (condition ? "ok   " : "FAIL ") << name << std::endl;
+	if (!condition) {
+		++g_failures;
+	}
+}
+
+static RqStatus parse( Request& request, const std::string& data ) {
+	request.raw += data;
+	request.status = request.parseRequest();
+	return request.status;
+}
+
+// The body looks like a request; after the rejected message nothing of it
+// may be left to parse
+static void checkRejected( const std::string& headers, const std::string& name ) {
+	Request request;
+	RqStatus status = parse(request, "POST /upload HTTP/1.1\r\nHost: x\r\n" + headers + "\r\n" + g_smuggled);
+	check(status == INVALID, name + " is rejected");
+	request.reset();
+	check(request.raw.empty() && request.parseRequest() == NEW, name + " leaves no request behind");
+}
+
+int main( void ) {
+	checkRejected("Content-Length: abc\r\n", "non-numeric Content-Length");
+	checkRejected("Content-Length: -5\r\n", "negative Content-Length");
+	checkRejected("Content-Length: \r\n", "empty Content-Length");
+	checkRejected("Content-Length: 10abc\r\n", "Content-Length with trailing junk");
+	checkRejected("Content-Length: 99999999999999999999999\r\n", "out of range Content-Length");
+	checkRejected("Content-Length: 0\r\nContent-Length: 32\r\n", "conflicting Content-Length headers");
+
+	{
+		Request request;
+		std::string length = std::to_string(g_smuggled.size());
+		RqStatus status = parse(request, "POST /upload HTTP/1.1\r\nHost: x\r\nContent-Length: " + length
+			+ "\r\nContent-Length: " + length + "\r\n\r\n" + g_smuggled + "GET /next HTTP/1.1\r\nHost: x\r\n\r\n");
+		check(status == FULL_BODY && request.getBody() == g_smuggled, "repeated equal Content-Length frames the body");
+		request.reset();
+		status = request.parseRequest();
+		check(status == FULL_BODY && request.getPath() == "/next", "the request after the body is the pipelined one");
+	}
+	{
+		Request request;
+		RqStatus status = parse(request, "POST /upload HTTP/1.1\r\nHost: x\r\nContent-Length:  0 \r\n\r\n");
+		check(status == FULL_BODY && request.content_length == 0, "Content-Length with surrounding spaces");
+	}
+	return g_failures == 0 ? 0 : 1;
+}